@@ -0,0 +1,54 @@
+#pragma once
+
+#include "sirius/defs.h"
+
+#include <new>
+#include <utility>
+
+constexpr usize CACHE_LINE_SIZE = 64;
+
+// allocator for std::vector whose storage starts at an ALIGNMENT byte boundary
+// elements without constructor args are default initialized rather than zeroed, so resize()
+// leaves the pages untouched until whichever thread fills them (first touch numa placement)
+template<typename T, usize ALIGNMENT = CACHE_LINE_SIZE>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, ALIGNMENT>;
+    };
+
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGNMENT>&)
+    {
+    }
+
+    T* allocate(usize count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(ALIGNMENT)));
+    }
+
+    void deallocate(T* ptr, usize)
+    {
+        ::operator delete(ptr, std::align_val_t(ALIGNMENT));
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args)
+    {
+        if constexpr (sizeof...(Args) == 0)
+            ::new (static_cast<void*>(ptr)) U;
+        else
+            ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, ALIGNMENT>&) const
+    {
+        return true;
+    }
+};
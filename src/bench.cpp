@@ -0,0 +1,426 @@
+#include "bench.h"
+#include "dataset.h"
+#include "eval_fn.h"
+#include "gradient_arena.h"
+#include "settings.h"
+#include "thread_pool.h"
+#include "sirius/board.h"
+#include "sirius/movegen.h"
+#include "sirius/util/prng.h"
+#include "tune_kernels.h"
+
+#include <charconv>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+
+namespace
+{
+
+constexpr i32 BENCH_POSITIONS = 262144;
+constexpr i32 BENCH_ITERATIONS = 10;
+constexpr i32 BENCH_FENS = 65536;
+constexpr i32 BENCH_PARSE_ITERATIONS = 8;
+
+struct ParamRange
+{
+    i32 begin;
+    i32 end;
+};
+
+i16 randomIndex(PRNG& prng, ParamRange range)
+{
+    return static_cast<i16>(range.begin + prng.next64() % (range.end - range.begin));
+}
+
+i16 randomValue(PRNG& prng)
+{
+    i16 value = static_cast<i16>(1 + prng.next64() % 3);
+    return prng.next64() % 2 ? value : static_cast<i16>(-value);
+}
+
+// roughly the segment sizes of real data, with random indices of the right param type
+Dataset syntheticDataset(const EvalParams& params)
+{
+    ParamRange normal = {0, 0}, safety = {0, 0}, complexity = {0, 0};
+    for (i32 i = 0; i < static_cast<i32>(params.totalSize()); i++)
+    {
+        ParamRange& range = params[i].type == ParamType::NORMAL ? normal
+            : params[i].type == ParamType::SAFETY               ? safety
+                                                                : complexity;
+        if (range.begin == range.end)
+            range.begin = i;
+        range.end = i + 1;
+    }
+
+    PRNG prng;
+    prng.seed(1234567);
+
+    Dataset dataset;
+    for (i32 i = 0; i < BENCH_POSITIONS; i++)
+    {
+        Position pos;
+        pos.coeffBegin = dataset.allCoefficients.size();
+        pos.normalCount = static_cast<u8>(20 + prng.next64() % 40);
+        pos.safetyCount[Color::WHITE] = static_cast<u8>(4 + prng.next64() % 12);
+        pos.safetyCount[Color::BLACK] = static_cast<u8>(4 + prng.next64() % 12);
+        pos.complexityCount = static_cast<u8>(1 + prng.next64() % 4);
+        pos.setScore(static_cast<i32>(prng.next64() % 1001) - 500);
+        double wdl = static_cast<double>(prng.next64() % 3) / 2.0;
+        pos.setWdlPhase(wdl, static_cast<i32>(prng.next64() % 25));
+        pos.egScaleFactor = static_cast<u8>(80 + prng.next64() % 57);
+
+        for (i32 j = 0; j < pos.normalCount; j++)
+            dataset.allCoefficients.push_back({randomIndex(prng, normal), randomValue(prng)});
+        for (i32 j = 0; j < pos.safetyCount[Color::WHITE] + pos.safetyCount[Color::BLACK]; j++)
+            dataset.allCoefficients.push_back({randomIndex(prng, safety), randomValue(prng)});
+        for (i32 j = 0; j < pos.complexityCount; j++)
+            dataset.allCoefficients.push_back({randomIndex(prng, complexity), randomValue(prng)});
+
+        dataset.positions.push_back(pos);
+    }
+    return dataset;
+}
+
+// positions from random games
+std::vector<std::string> randomFens()
+{
+    PRNG prng;
+    prng.seed(7654321);
+
+    std::vector<std::string> fens;
+    while (fens.size() < BENCH_FENS)
+    {
+        Board board;
+        for (i32 ply = 0; ply < 200 && fens.size() < BENCH_FENS; ply++)
+        {
+            MoveList moves;
+            genMoves<MoveGenType::LEGAL>(board, moves);
+            if (moves.size() == 0 || board.halfMoveClock() >= 100)
+                break;
+            board.makeMove(moves[prng.next64() % moves.size()]);
+            fens.push_back(board.fenStr());
+        }
+    }
+    return fens;
+}
+
+// fen | score | wdl lines of the random positions
+std::string randomDatasetText(const std::vector<std::string>& fens)
+{
+    PRNG prng;
+    prng.seed(2468);
+
+    constexpr const char* WDLS[] = {"0.0", "0.5", "1.0"};
+    std::string text;
+    for (const std::string& fen : fens)
+    {
+        i32 score = static_cast<i32>(prng.next64() % 1001) - 500;
+        text += fen + " | " + std::to_string(score) + " | " + WDLS[prng.next64() % 3] + "\n";
+    }
+    return text;
+}
+
+// the per line work of the loader before the memory mapped parser, without the trace: a
+// string per line from getline, a find for each wdl marker, the spaces and the bar, and
+// setToFen on a new board. returns the number of lines
+i64 legacyParse(const std::string& text)
+{
+    constexpr const char* MARKERS[] = {"1-0", "0-1", "1/2-1/2", "1.0", "0.0", "0.5"};
+    std::istringstream stream(text);
+    std::string line;
+    i64 lines = 0;
+    while (std::getline(stream, line))
+    {
+        usize marker = 0;
+        while (marker < std::size(MARKERS) && line.find(MARKERS[marker]) == std::string::npos)
+            marker++;
+
+        usize sixthSpace = SIZE_MAX;
+        for (i32 i = 0; i < 6; i++)
+            sixthSpace = line.find(' ', sixthSpace + 1);
+        usize firstBar = line.find('|');
+        if (sixthSpace == std::string::npos || firstBar == std::string::npos
+            || marker == std::size(MARKERS))
+            return -1;
+
+        i32 score;
+        auto [ptr, ec] =
+            std::from_chars(line.c_str() + firstBar + 2, line.c_str() + line.size(), score);
+        if (ec != std::errc())
+            return -1;
+
+        Board board;
+        board.setToFen(std::string_view(line.begin(), line.begin() + sixthSpace));
+        lines++;
+    }
+    return lines;
+}
+
+bool sameBoard(const Board& a, const Board& b)
+{
+    for (Color color : {Color::WHITE, Color::BLACK})
+    {
+        for (i32 i = 0; i < 6; i++)
+        {
+            PieceType type = static_cast<PieceType>(i);
+            if (a.pieces(color, type) != b.pieces(color, type))
+                return false;
+        }
+        if (a.pinners(color) != b.pinners(color) || a.discoverers(color) != b.discoverers(color)
+            || a.checkBlockers(color) != b.checkBlockers(color))
+            return false;
+    }
+    return a.sideToMove() == b.sideToMove() && a.zkey() == b.zkey()
+        && a.checkers() == b.checkers() && a.epSquare() == b.epSquare()
+        && a.gamePly() == b.gamePly() && a.halfMoveClock() == b.halfMoveClock();
+}
+
+struct BenchResult
+{
+    double evalTime;
+    double gradientTime;
+    std::vector<double> evals;
+    // widened to double for comparing against the reference
+    std::vector<Gradient> gradients;
+};
+
+template<typename Real>
+BenchResult benchKernels(const TuneKernels<Real>& kernels,
+    std::span<const Position> positions, Coeffs coefficients, const EvalParams& params)
+{
+    BenchResult result;
+    result.evals.resize(positions.size());
+    std::vector<PackedParam<Real>> packed;
+    packParams(params, packed);
+    std::vector<BasicGradient<Real>> gradients(params.totalSize());
+
+    GradientArgs args = {0.0025, 0.0025, 0.75};
+
+    auto t1 = std::chrono::steady_clock::now();
+    for (i32 i = 0; i < BENCH_ITERATIONS; i++)
+        kernels.evaluate(positions, coefficients, packed.data(), result.evals.data());
+    auto t2 = std::chrono::steady_clock::now();
+    for (i32 i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        std::fill(gradients.begin(), gradients.end(), BasicGradient<Real>{0, 0});
+        kernels.updateGradients(positions, coefficients, packed.data(), args, gradients.data());
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    result.evalTime = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+    result.gradientTime = std::chrono::duration_cast<std::chrono::duration<double>>(t3 - t2).count();
+    for (const auto& grad : gradients)
+        result.gradients.push_back({grad.mg, grad.eg});
+    return result;
+}
+
+// timings relative to the reference and the largest differences from its results
+void printResult(const std::string& name, const BenchResult& result, const BenchResult& reference)
+{
+    double positions = static_cast<double>(BENCH_POSITIONS) * BENCH_ITERATIONS;
+    std::cout << name << " evaluate: " << positions / result.evalTime / 1e6 << " Mpos/s ("
+              << reference.evalTime / result.evalTime << "x)" << std::endl;
+    std::cout << name << " gradient: " << positions / result.gradientTime / 1e6 << " Mpos/s ("
+              << reference.gradientTime / result.gradientTime << "x)" << std::endl;
+
+    double maxEvalDiff = 0, maxGradientDiff = 0;
+    for (size_t i = 0; i < reference.evals.size(); i++)
+        maxEvalDiff = std::max(maxEvalDiff, std::abs(reference.evals[i] - result.evals[i]));
+    for (size_t i = 0; i < reference.gradients.size(); i++)
+    {
+        maxGradientDiff = std::max(
+            maxGradientDiff, std::abs(reference.gradients[i].mg - result.gradients[i].mg));
+        maxGradientDiff = std::max(
+            maxGradientDiff, std::abs(reference.gradients[i].eg - result.gradients[i].eg));
+    }
+    std::cout << name << " max eval difference: " << maxEvalDiff << std::endl;
+    std::cout << name << " max gradient difference: " << maxGradientDiff << std::endl;
+}
+
+template<typename Real>
+void benchPrecision(std::span<const Position> positions, Coeffs coefficients,
+    const EvalParams& params, const BenchResult& reference)
+{
+    std::string precision = std::is_same_v<Real, double> ? " double" : " float";
+    const TuneKernels<Real>& scalar = scalarKernels<Real>();
+    printResult(scalar.name + precision, benchKernels(scalar, positions, coefficients, params),
+        reference);
+
+    const TuneKernels<Real>* simd = avx2Kernels<Real>();
+    if (!simd)
+    {
+        std::cout << "No simd kernels supported on this cpu" << std::endl;
+        return;
+    }
+    printResult(
+        simd->name + precision, benchKernels(*simd, positions, coefficients, params), reference);
+}
+
+}
+
+void runKernelBench()
+{
+    EvalParams params = EvalFn::getInitialParams();
+    Dataset dataset = syntheticDataset(params);
+    std::cout << "Synthetic dataset: " << dataset.positions.size() << " positions, "
+              << dataset.allCoefficients.size() << " coefficients" << std::endl;
+
+    // everything is compared against the scalar double kernels
+    BenchResult reference = benchKernels<double>(
+        scalarKernels<double>(), dataset.positions, dataset.allCoefficients, params);
+    std::cout << "Reference is scalar double" << std::endl;
+    benchPrecision<double>(dataset.positions, dataset.allCoefficients, params, reference);
+    benchPrecision<float>(dataset.positions, dataset.allCoefficients, params, reference);
+}
+
+void runThreadPoolBench(u32 threads)
+{
+    constexpr i32 DISPATCHES = 100000;
+    ThreadPool threadPool(threads);
+    std::vector<u64> counters(threadPool.concurrency() * 8, 0);
+
+    // warm up so the workers are already running
+    for (i32 i = 0; i < 1000; i++)
+        threadPool.run([](u32) {});
+
+    auto t1 = std::chrono::steady_clock::now();
+    for (i32 i = 0; i < DISPATCHES; i++)
+    {
+        threadPool.run(
+            [&counters](u32 threadID)
+            {
+                counters[threadID * 8]++;
+            });
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+    std::cout << "Thread pool: " << threadPool.concurrency() << " threads, "
+              << seconds / DISPATCHES * 1e6 << " us per dispatch" << std::endl;
+}
+
+void runFenBench()
+{
+    std::vector<std::string> fens = randomFens();
+
+    // a new board per fen, like the dataset loader used to do
+    auto t1 = std::chrono::steady_clock::now();
+    for (const std::string& fen : fens)
+    {
+        Board board;
+        board.setToFen(fen);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+    std::cout << "setToFen: " << fens.size() / seconds / 1e6 << " Mfen/s" << std::endl;
+
+    Board board;
+    for (bool validate : {false, true})
+    {
+        auto t3 = std::chrono::steady_clock::now();
+        for (const std::string& fen : fens)
+            board.loadFen(fen, validate);
+        auto t4 = std::chrono::steady_clock::now();
+        seconds = std::chrono::duration_cast<std::chrono::duration<double>>(t4 - t3).count();
+        std::cout << "loadFen" << (validate ? " (validated)" : "") << ": "
+                  << fens.size() / seconds / 1e6 << " Mfen/s" << std::endl;
+    }
+
+    i32 mismatches = 0, invalid = 0;
+    Board reference;
+    for (const std::string& fen : fens)
+    {
+        reference.setToFen(fen);
+        invalid += !board.loadFen(fen, true);
+        mismatches += !sameBoard(reference, board);
+    }
+    std::cout << "loadFen mismatches: " << mismatches << ", rejected as invalid: " << invalid
+              << std::endl;
+}
+
+void runParseBench()
+{
+    std::string text = randomDatasetText(randomFens());
+
+    // best of several runs, the ratio is what matters and a noisy machine skews single runs
+    auto measure = [&](auto&& parse)
+    {
+        double best = 0;
+        for (i32 i = 0; i < BENCH_PARSE_ITERATIONS; i++)
+        {
+            auto t1 = std::chrono::steady_clock::now();
+            i64 lines = parse();
+            auto t2 = std::chrono::steady_clock::now();
+            double seconds =
+                std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+            best = std::max(best, lines / seconds);
+        }
+        return best;
+    };
+
+    double legacy = measure(
+        [&]()
+        {
+            return legacyParse(text);
+        });
+    std::cout << "Legacy parse: " << legacy / 1e6 << " Mlines/s" << std::endl;
+    for (bool validate : {false, true})
+    {
+        double linesPerSecond = measure(
+            [&]()
+            {
+                return parseDatasetText(text, validate);
+            });
+        std::cout << "Parser" << (validate ? " (validated)" : "") << ": "
+                  << linesPerSecond / 1e6 << " Mlines/s (" << linesPerSecond / legacy
+                  << "x, target 5x)" << std::endl;
+    }
+}
+
+void runReduceBench(u32 threads)
+{
+    ThreadPool threadPool(threads);
+    EvalParams params = EvalFn::getInitialParams();
+    Dataset dataset = syntheticDataset(params);
+    const TuneKernels<double>& kernels = bestKernels<double>();
+
+    std::vector<PackedParam<double>> packed;
+    packParams(params, packed);
+    GradientArena<double> arena(threadPool.concurrency(), params.totalSize());
+    std::vector<Gradient> gradients(params.totalSize());
+    GradientArgs args = {0.0025, 0.0025, 0.75};
+
+    // the same two steps as a batch of the tuner, timed separately
+    double gradientSeconds = 0, reduceSeconds = 0;
+    i32 batches = 0;
+    for (i32 i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        for (usize begin = 0; begin + BATCH_SIZE <= dataset.positions.size(); begin += BATCH_SIZE)
+        {
+            std::span<const Position> batch(dataset.positions.data() + begin, BATCH_SIZE);
+            auto t1 = std::chrono::steady_clock::now();
+            threadPool.parallelFor(0, batch.size(),
+                [&](u32 threadID, usize sliceBegin, usize sliceEnd)
+                {
+                    kernels.updateGradients(batch.subspan(sliceBegin, sliceEnd - sliceBegin),
+                        dataset.allCoefficients, packed.data(), args, arena.thread(threadID));
+                });
+            auto t2 = std::chrono::steady_clock::now();
+            arena.reduce(threadPool, gradients, 1.0 / BATCH_SIZE);
+            auto t3 = std::chrono::steady_clock::now();
+
+            gradientSeconds +=
+                std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+            reduceSeconds +=
+                std::chrono::duration_cast<std::chrono::duration<double>>(t3 - t2).count();
+            batches++;
+        }
+    }
+
+    std::cout << "Gradient reduce: " << threadPool.concurrency() << " threads, "
+              << reduceSeconds / batches * 1e6 << " us per batch, "
+              << 100 * reduceSeconds / (gradientSeconds + reduceSeconds) << "% of a batch"
+              << std::endl;
+}
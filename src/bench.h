@@ -0,0 +1,14 @@
+#pragma once
+
+#include "sirius/defs.h"
+
+// compares the scalar and simd tuning kernels on a fixed synthetic dataset
+void runKernelBench();
+// measures how long the thread pool takes to dispatch and join an empty job
+void runThreadPoolBench(u32 threads);
+// times reducing the per thread gradients against computing them for the tuner's batches
+void runReduceBench(u32 threads);
+// compares Board::setToFen against the bulk loading Board::loadFen on random positions
+void runFenBench();
+// compares the dataset line parser against the getline and setToFen loop it replaced
+void runParseBench();
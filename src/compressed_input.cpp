@@ -0,0 +1,255 @@
+#include "compressed_input.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef TUNE_HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef TUNE_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+
+constexpr u8 GZIP_MAGIC[] = {0x1F, 0x8B};
+constexpr u8 ZSTD_MAGIC[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+// total size of the bgzf member at the start of data, or 0 if it isn't one
+usize bgzfMemberSize(std::span<const u8> data)
+{
+    // fixed header, then xlen and the extra subfields
+    constexpr usize HEADER_SIZE = 12;
+    constexpr u8 FEXTRA = 4;
+    if (data.size() < HEADER_SIZE || data[0] != GZIP_MAGIC[0] || data[1] != GZIP_MAGIC[1]
+        || !(data[3] & FEXTRA))
+        return 0;
+
+    usize xlen = data[10] | (data[11] << 8);
+    if (data.size() < HEADER_SIZE + xlen)
+        return 0;
+    std::span<const u8> extra = data.subspan(HEADER_SIZE, xlen);
+    for (usize i = 0; i + 4 <= extra.size();)
+    {
+        usize fieldSize = extra[i + 2] | (extra[i + 3] << 8);
+        if (extra[i] == 'B' && extra[i + 1] == 'C' && fieldSize == 2 && i + 6 <= extra.size())
+        {
+            usize blockSize = (extra[i + 4] | (extra[i + 5] << 8)) + 1;
+            return blockSize <= data.size() ? blockSize : 0;
+        }
+        i += 4 + fieldSize;
+    }
+    return 0;
+}
+
+// size of the frame at the start of data, or 0 if the frames can't be found
+usize frameSize(Compression compression, std::span<const u8> data)
+{
+    if (compression == Compression::GZIP)
+        return bgzfMemberSize(data);
+#ifdef TUNE_HAS_ZSTD
+    usize size = ZSTD_findFrameCompressedSize(data.data(), data.size());
+    return ZSTD_isError(size) ? 0 : size;
+#else
+    return 0;
+#endif
+}
+
+#ifdef TUNE_HAS_ZLIB
+bool decompressGzip(std::span<const u8> data, usize blockSize,
+    const std::function<void(std::string&& block)>& onBlock)
+{
+    z_stream stream = {};
+    // 32 detects the gzip header
+    if (inflateInit2(&stream, 15 + 32) != Z_OK)
+        return false;
+
+    const u8* next = data.data();
+    usize remaining = data.size();
+    std::string block(blockSize, '\0');
+    usize blockUsed = 0;
+    bool ended = false;
+    while (true)
+    {
+        // avail_in is only 32 bits
+        uInt inputSize = static_cast<uInt>(std::min<usize>(remaining, UINT32_MAX));
+        stream.next_in = const_cast<u8*>(next);
+        stream.avail_in = inputSize;
+        stream.next_out = reinterpret_cast<u8*>(block.data() + blockUsed);
+        stream.avail_out = static_cast<uInt>(blockSize - blockUsed);
+
+        // Z_BUF_ERROR means the data is truncated, since there is always room for output
+        int result = inflate(&stream, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END)
+        {
+            ended = false;
+            break;
+        }
+        usize consumed = inputSize - stream.avail_in;
+        next += consumed;
+        remaining -= consumed;
+        blockUsed = blockSize - stream.avail_out;
+
+        bool outputFull = blockUsed == blockSize;
+        if (outputFull)
+        {
+            onBlock(std::move(block));
+            block.assign(blockSize, '\0');
+            blockUsed = 0;
+        }
+        ended = result == Z_STREAM_END;
+        if (ended)
+        {
+            if (remaining == 0)
+                break;
+            // concatenated members, as written by bgzip or by appending gzip files
+            if (inflateReset(&stream) != Z_OK)
+            {
+                ended = false;
+                break;
+            }
+        }
+        else if (!outputFull && remaining == 0)
+            break;
+    }
+    inflateEnd(&stream);
+    if (!ended)
+        return false;
+
+    block.resize(blockUsed);
+    if (!block.empty())
+        onBlock(std::move(block));
+    return true;
+}
+#endif
+
+#ifdef TUNE_HAS_ZSTD
+bool decompressZstd(std::span<const u8> data, usize blockSize,
+    const std::function<void(std::string&& block)>& onBlock)
+{
+    ZSTD_DCtx* ctx = ZSTD_createDCtx();
+    ZSTD_inBuffer input = {data.data(), data.size(), 0};
+    std::string block(blockSize, '\0');
+    ZSTD_outBuffer output = {block.data(), blockSize, 0};
+    usize lastResult = 0;
+    while (true)
+    {
+        lastResult = ZSTD_decompressStream(ctx, &output, &input);
+        if (ZSTD_isError(lastResult))
+            break;
+        if (output.pos == output.size)
+        {
+            onBlock(std::move(block));
+            block.assign(blockSize, '\0');
+            output = {block.data(), blockSize, 0};
+        }
+        // everything decompressed and flushed
+        else if (input.pos == input.size)
+            break;
+    }
+    ZSTD_freeDCtx(ctx);
+    // nonzero means the last frame is truncated, or is the error that ended the loop
+    if (lastResult != 0)
+        return false;
+
+    block.resize(output.pos);
+    if (!block.empty())
+        onBlock(std::move(block));
+    return true;
+}
+#endif
+
+}
+
+Compression detectCompression(std::span<const u8> data)
+{
+    auto startsWith = [&](std::span<const u8> magic)
+    {
+        return data.size() >= magic.size()
+            && std::memcmp(data.data(), magic.data(), magic.size()) == 0;
+    };
+    if (startsWith(GZIP_MAGIC))
+        return Compression::GZIP;
+    if (startsWith(ZSTD_MAGIC))
+        return Compression::ZSTD;
+    return Compression::NONE;
+}
+
+const char* compressionName(Compression compression)
+{
+    switch (compression)
+    {
+        case Compression::GZIP:
+            return "gzip";
+        case Compression::ZSTD:
+            return "zstd";
+        default:
+            return "none";
+    }
+}
+
+bool compressionSupported(Compression compression)
+{
+    switch (compression)
+    {
+        case Compression::NONE:
+            return true;
+        case Compression::GZIP:
+#ifdef TUNE_HAS_ZLIB
+            return true;
+#else
+            return false;
+#endif
+        case Compression::ZSTD:
+#ifdef TUNE_HAS_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+std::vector<std::span<const u8>> splitFrames(
+    Compression compression, std::span<const u8> data, usize minUnitSize)
+{
+    std::vector<std::span<const u8>> units;
+    usize unitBegin = 0;
+    usize pos = 0;
+    while (pos < data.size())
+    {
+        usize size = frameSize(compression, data.subspan(pos));
+        // the rest can't be split, leave it in one range
+        if (size == 0)
+        {
+            pos = data.size();
+            break;
+        }
+        pos += size;
+        if (pos - unitBegin >= minUnitSize)
+        {
+            units.push_back(data.subspan(unitBegin, pos - unitBegin));
+            unitBegin = pos;
+        }
+    }
+    if (unitBegin < data.size())
+        units.push_back(data.subspan(unitBegin));
+    return units;
+}
+
+bool decompress(Compression compression, std::span<const u8> data, usize blockSize,
+    const std::function<void(std::string&& block)>& onBlock)
+{
+#ifdef TUNE_HAS_ZLIB
+    if (compression == Compression::GZIP)
+        return decompressGzip(data, blockSize, onBlock);
+#endif
+#ifdef TUNE_HAS_ZSTD
+    if (compression == Compression::ZSTD)
+        return decompressZstd(data, blockSize, onBlock);
+#endif
+    // unreachable for callers that checked compressionSupported, this runs on loader threads
+    // so it must not exit
+    return false;
+}
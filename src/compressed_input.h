@@ -0,0 +1,33 @@
+#pragma once
+
+#include "sirius/defs.h"
+
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+enum class Compression
+{
+    NONE,
+    GZIP,
+    ZSTD
+};
+
+// from the magic bytes at the start of the data
+Compression detectCompression(std::span<const u8> data);
+const char* compressionName(Compression compression);
+// false if this build was compiled without the library for it
+bool compressionSupported(Compression compression);
+
+// splits the data into ranges of whole frames that decompress independently, each at least
+// minUnitSize bytes except the last. gzip can only be split if it is bgzf, with the size of
+// each member in its header, otherwise the whole data is one range
+std::vector<std::span<const u8>> splitFrames(
+    Compression compression, std::span<const u8> data, usize minUnitSize);
+
+// decompresses every frame in data, calling onBlock with about blockSize bytes of output at a
+// time. false if the data is corrupt, after passing on what came before the corruption.
+// the compression must be one compressionSupported accepts, false otherwise
+bool decompress(Compression compression, std::span<const u8> data, usize blockSize,
+    const std::function<void(std::string&& block)>& onBlock);
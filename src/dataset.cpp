@@ -1,88 +1,1317 @@
 #include "dataset.h"
+#include "compressed_input.h"
 #include "eval_fn.h"
+#include "mapped_file.h"
+#include "packed_formats.h"
+#include "qsearch.h"
 #include "sirius/board.h"
+#include "sirius/movegen.h"
+#include "sirius/util/murmur.h"
+#include "sirius/util/prng.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <atomic>
 #include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 
 constexpr struct
 {
-    const char* str;
+    std::string_view str;
     double wdl;
 } wdls[] = {{"1-0", 1.0}, {"0-1", 0.0}, {"1/2-1/2", 0.5}, {"1.0", 1.0}, {"0.0", 0.0}, {"0.5", 0.5}};
 
-Dataset loadDataset(std::ifstream& file)
+struct DatasetChunk
 {
-    std::vector<Coefficient> allCoefficients;
+    std::vector<Coefficient> coefficients;
     std::vector<Position> positions;
-    EvalFn eval(allCoefficients);
-    std::string line;
+    // zobrist key of each position, for deduplication
+    std::vector<u64> keys;
+};
 
-    while (std::getline(file, line))
+// uncompressed shards are split into at most 4 ranges per thread of at least this many bytes
+constexpr usize MIN_RANGE_SIZE = 1 << 20;
+// compressed shards are split into ranges of at least this many bytes of whole frames,
+// and each range is handed to the parsers in blocks of this many bytes of text
+constexpr usize COMPRESSED_RANGE_SIZE = 4 << 20;
+constexpr usize DECOMPRESSED_BLOCK_SIZE = 8 << 20;
+
+struct ShardFile
+{
+    const DatasetShard* shard;
+    std::unique_ptr<MappedFile> file;
+    Compression compression;
+};
+
+// a range of one shard for a loader thread, byte offsets into the mapping.
+// ranges of compressed shards hold whole frames
+struct LoadRange
+{
+    u32 shard;
+    u64 begin;
+    u64 end;
+};
+
+// decompressed text, the index'th block of a range
+struct TextBlock
+{
+    u32 range;
+    u32 index;
+    // of the text in the decompressed range
+    u64 offset;
+    std::string text;
+};
+
+// positions dropped by each filter, and the ones moved to a quiet leaf before tracing
+struct LoadStats
+{
+    std::atomic_uint64_t inCheck = 0;
+    std::atomic_uint64_t noisy = 0;
+    std::atomic_uint64_t score = 0;
+    std::atomic_uint64_t ply = 0;
+    std::atomic_uint64_t resolved = 0;
+    std::atomic_uint64_t resolvedPlies = 0;
+};
+
+// bottom k sample by a seeded hash of the zobrist key and the record id, which is a uniform
+// sample of k positions however the files are split between threads. the record id keeps
+// the copies of a position independent, by the key alone they would all be sampled or none.
+// only a packed copy of each board is kept, the sample is traced once every file has been read
+class PositionReservoir
+{
+public:
+    struct Entry
     {
-        double wdlResult = -1.0;
-        for (auto& wdl : wdls)
+        u64 priority;
+        u32 shard;
+        std::array<u8, PACKED_RECORD_SIZE> record;
+
+        bool operator<(const Entry& other) const
         {
-            if (line.find(wdl.str) != std::string::npos)
-            {
-                wdlResult = wdl.wdl;
+            return std::tie(priority, shard, record)
+                < std::tie(other.priority, other.shard, other.record);
+        }
+    };
+
+    explicit PositionReservoir(u64 capacity)
+        : m_Capacity(capacity)
+    {
+    }
+
+    void offer(const Board& board, i32 score, double wdl, u32 shard, u64 recordId)
+    {
+        Entry entry;
+        entry.priority = murmurHash3(
+            board.zkey().value ^ murmurHash3(recordId ^ murmurHash3(shard ^ RESERVOIR_SEED)));
+        // most positions lose to a full reservoir, check that without the lock
+        if (entry.priority > m_Threshold.load(std::memory_order_relaxed))
+            return;
+        entry.shard = shard;
+        encodeMarlinformat(board, score, wdl, entry.record.data());
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Heap.size() < m_Capacity)
+        {
+            m_Heap.push_back(entry);
+            std::push_heap(m_Heap.begin(), m_Heap.end());
+        }
+        else if (entry < m_Heap.front())
+        {
+            std::pop_heap(m_Heap.begin(), m_Heap.end());
+            m_Heap.back() = entry;
+            std::push_heap(m_Heap.begin(), m_Heap.end());
+        }
+        if (m_Heap.size() == m_Capacity)
+            m_Threshold.store(m_Heap.front().priority, std::memory_order_relaxed);
+    }
+
+    // sorted by shard, then randomly by priority
+    std::vector<Entry> take()
+    {
+        std::vector<Entry> entries = std::move(m_Heap);
+        std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b)
+            { return std::tie(a.shard, a) < std::tie(b.shard, b); });
+        return entries;
+    }
+
+private:
+    static constexpr u64 RESERVOIR_SEED = 0x5245534552564F49;
+
+    u64 m_Capacity;
+    std::mutex m_Mutex;
+    // max heap of the sample so far
+    std::vector<Entry> m_Heap;
+    std::atomic_uint64_t m_Threshold = UINT64_MAX;
+};
+
+// the first error of any loader thread, reported by the calling thread once they are done.
+// exiting from a worker would run the static destructors while the other threads still parse
+class LoadError
+{
+public:
+    void set(std::string message)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Failed.load(std::memory_order_relaxed))
+            return;
+        m_Message = std::move(message);
+        m_Failed.store(true, std::memory_order_relaxed);
+    }
+
+    // checked between lines so the other threads stop soon after an error
+    bool failed() const
+    {
+        return m_Failed.load(std::memory_order_relaxed);
+    }
+
+    // only called once no thread can set the error anymore
+    void check() const
+    {
+        if (!failed())
+            return;
+        std::cout << "Error: " << m_Message << std::endl;
+        exit(1);
+    }
+
+private:
+    std::mutex m_Mutex;
+    std::atomic_bool m_Failed = false;
+    std::string m_Message;
+};
+
+// what the parsers need to know about the shard they read
+struct ParseContext
+{
+    const DatasetLoadOptions& options;
+    u32 shard;
+    bool sampleAll;
+    // a position is kept if the hash of its key and the seed is below this
+    u64 sampleThreshold;
+    u64 seed;
+    std::atomic_uint64_t& loadedPositions;
+    LoadStats& stats;
+    LoadError& error;
+    // nullptr to trace positions as soon as they pass the filters
+    PositionReservoir* reservoir;
+};
+
+// the text before the first and after the last newline of a block belongs to lines
+// shared with the neighbouring blocks, which are parsed after every block is done
+struct ParsedBlock
+{
+    DatasetChunk chunk;
+    std::string head;
+    std::string tail;
+    bool hasNewline = false;
+    // of the head and the tail in the decompressed range
+    u64 offset = 0;
+    u64 tailOffset = 0;
+};
+
+// first occurrence of c in [begin, end), or end. memchr is vectorized by the c library
+const char* findChar(const char* begin, const char* end, char c)
+{
+    const void* found = std::memchr(begin, c, static_cast<usize>(end - begin));
+    return found ? static_cast<const char*>(found) : end;
+}
+
+// the wdl of the first marker in wdls that appears in text, or -1
+double findWdl(std::string_view text)
+{
+    // usually the result is the last field by itself
+    std::string_view last = text.substr(0, text.find_last_not_of(' ') + 1);
+    last.remove_prefix(std::min(last.size(), last.find_last_of(' ') + 1));
+    for (auto& wdl : wdls)
+        if (last == wdl.str)
+            return wdl.wdl;
+
+    for (auto& wdl : wdls)
+        if (text.find(wdl.str) != std::string_view::npos)
+            return wdl.wdl;
+    return -1.0;
+}
+
+// the sample is decided by the zobrist key so it doesn't depend on how the shard is split,
+// and before the coefficients so skipped positions are cheap
+bool sampled(const Board& board, u64 recordId, const ParseContext& ctx)
+{
+    return ctx.sampleAll
+        || murmurHash3(board.zkey().value ^ murmurHash3(recordId ^ ctx.seed))
+        < ctx.sampleThreshold;
+}
+
+// whether the side to move has a legal capture or promotion that doesn't lose material,
+// the score of such a position mostly depends on the exchange rather than the eval terms
+bool hasGoodNoisyMove(Board& board)
+{
+    board.initThreats();
+    MoveList moves;
+    genMoves<MoveGenType::NOISY>(board, moves);
+    for (Move move : moves)
+        if (board.isLegal(move) && board.see(move, 0))
+            return true;
+    return false;
+}
+
+// cheapest checks first
+bool passesFilters(Board& board, i32 score, const ParseContext& ctx)
+{
+    const DatasetLoadOptions& options = ctx.options;
+    if (options.skipInCheck && board.checkers().any())
+    {
+        ctx.stats.inCheck.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (options.maxScore > 0 && std::abs(score) > options.maxScore)
+    {
+        ctx.stats.score.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (options.minPly > 0 && options.format != DatasetFormat::BULLETFORMAT
+        && board.gamePly() < options.minPly)
+    {
+        ctx.stats.ply.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (options.skipNoisy && hasGoodNoisyMove(board))
+    {
+        ctx.stats.noisy.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+// the filters see the position from the dataset and the trace sees its quiet leaf, while
+// the score and wdl stay the ones the dataset gave
+// recordId is where the position starts in its shard, the same however the files are split
+// between threads: the offset in the file, or for compressed data the offset in the
+// decompressed range mixed with a hash of the range's offset
+void addPosition(Board& board, i32 score, double wdl, u64 recordId, EvalFn& eval,
+    DatasetChunk& chunk, const ParseContext& ctx)
+{
+    if (!sampled(board, recordId, ctx) || !passesFilters(board, score, ctx))
+        return;
+    if (ctx.reservoir)
+    {
+        ctx.reservoir->offer(board, score, wdl, ctx.shard, recordId);
+        return;
+    }
+    if (ctx.options.resolvePly > 0)
+    {
+        if (i32 plies = resolveQuiet(board, ctx.options.resolvePly))
+        {
+            ctx.stats.resolved.fetch_add(1, std::memory_order_relaxed);
+            ctx.stats.resolvedPlies.fetch_add(plies, std::memory_order_relaxed);
+        }
+    }
+
+    Position pos;
+    if (!eval.getCoefficients(board, pos))
+    {
+        ctx.error.set("Too many coefficients in one segment of position: " + board.fenStr());
+        return;
+    }
+    pos.setScore(score);
+    i32 phase = 4 * board.pieces(PieceType::QUEEN).popcount()
+        + 2 * board.pieces(PieceType::ROOK).popcount() + board.pieces(PieceType::BISHOP).popcount()
+        + board.pieces(PieceType::KNIGHT).popcount();
+    pos.setWdlPhase(wdl, std::min(phase, MAX_PHASE));
+
+    chunk.positions.push_back(pos);
+    chunk.keys.push_back(board.zkey().value);
+}
+
+// loads the fen of a fen | score | wdl line into board, returns the start of the error
+// message if the line is invalid
+const char* parseFields(
+    std::string_view line, bool validateFen, Board& board, i32& score, double& wdl)
+{
+    const char* begin = line.data();
+    const char* end = line.data() + line.size();
+
+    const char* bar = findChar(begin, end, '|');
+    if (bar == end)
+        return "Invalid data: ";
+
+    // the fen is normally everything up to the space before the bar
+    const char* fenEnd = bar - 1;
+    if (bar == begin || *fenEnd != ' ' || std::count(begin, bar, ' ') != 6)
+    {
+        fenEnd = begin;
+        for (i32 spaces = 0; fenEnd < end; fenEnd++)
+            if (*fenEnd == ' ' && ++spaces == 6)
                 break;
-            }
+        if (fenEnd == end)
+            return "Invalid data: ";
+    }
+
+    auto [ptr, ec] = std::from_chars(std::min(bar + 2, end), end, score);
+    if (ec != std::errc())
+        return "Invalid Data, Could not parse score: ";
+
+    // the markers can't appear inside a fen or an integer score
+    wdl = findWdl(std::string_view(bar, end));
+    if (wdl == -1.0)
+    {
+        std::cout << "Warning: line with no wdl marker, defaulting to 0.5" << std::endl;
+        wdl = 0.5;
+    }
+
+    if (!board.loadFen(std::string_view(begin, fenEnd), validateFen))
+        return "Invalid fen: ";
+    return nullptr;
+}
+
+bool parseLine(std::string_view line, u64 recordId, EvalFn& eval, Board& board,
+    DatasetChunk& chunk, const ParseContext& ctx)
+{
+    i32 score;
+    double wdl;
+    if (const char* error = parseFields(line, ctx.options.validateFens, board, score, wdl))
+    {
+        ctx.error.set(error + std::string(line));
+        return false;
+    }
+    addPosition(board, score, wdl, recordId, eval, chunk, ctx);
+    return true;
+}
+
+void reportLoaded(std::atomic_uint64_t& loadedPositions)
+{
+    u64 loaded = loadedPositions.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (loaded % 65536 == 0)
+        std::cout << "Loaded " + std::to_string(loaded) + " positions \n" << std::flush;
+}
+
+// false after an error
+bool parseTextLine(std::string_view line, u64 recordId, EvalFn& eval, Board& board,
+    DatasetChunk& chunk, const ParseContext& ctx)
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    if (line.empty())
+        return true;
+
+    if (!parseLine(line, recordId, eval, board, chunk, ctx))
+        return false;
+    reportLoaded(ctx.loadedPositions);
+    return true;
+}
+
+// parses every line that starts inside [begin, end) of the mapped file, until any thread
+// has an error
+void loadChunk(
+    const MappedFile& file, u64 begin, u64 end, DatasetChunk& chunk, const ParseContext& ctx)
+{
+    EvalFn eval(chunk.coefficients);
+    // reused for every line
+    Board board;
+    const char* data = reinterpret_cast<const char*>(file.data());
+    const char* fileEnd = data + file.size();
+
+    const char* lineBegin = data + begin;
+    // a line starting exactly at begin belongs to this chunk,
+    // otherwise skip the partial line owned by the previous chunk
+    if (begin > 0 && data[begin - 1] != '\n')
+        lineBegin = std::min(findChar(lineBegin, fileEnd, '\n') + 1, fileEnd);
+
+    while (lineBegin < data + end && !ctx.error.failed())
+    {
+        const char* lineEnd = findChar(lineBegin, fileEnd, '\n');
+        std::string_view line(lineBegin, lineEnd);
+        lineBegin = std::min(lineEnd + 1, fileEnd);
+        if (!parseTextLine(line, static_cast<u64>(line.data() - data), eval, board, chunk, ctx))
+            return;
+    }
+}
+
+// parses every line of text, which starts at offset in the decompressed range with the hashed
+// range offset origin, until any thread has an error
+void parseLines(std::string_view text, u64 origin, u64 offset, DatasetChunk& chunk,
+    const ParseContext& ctx)
+{
+    EvalFn eval(chunk.coefficients);
+    Board board;
+    const char* lineBegin = text.data();
+    const char* end = text.data() + text.size();
+    while (lineBegin < end && !ctx.error.failed())
+    {
+        const char* lineEnd = findChar(lineBegin, end, '\n');
+        u64 recordId = origin ^ (offset + static_cast<u64>(lineBegin - text.data()));
+        if (!parseTextLine(
+                std::string_view(lineBegin, lineEnd), recordId, eval, board, chunk, ctx))
+            return;
+        lineBegin = lineEnd + 1;
+    }
+}
+
+ParsedBlock parseBlock(std::string_view text, u64 origin, u64 offset, const ParseContext& ctx)
+{
+    ParsedBlock result;
+    result.offset = offset;
+    usize first = text.find('\n');
+    if (first == std::string_view::npos)
+    {
+        result.head = text;
+        return result;
+    }
+    usize last = text.rfind('\n');
+    result.hasNewline = true;
+    result.head = text.substr(0, first);
+    result.tail = text.substr(last + 1);
+    result.tailOffset = offset + last + 1;
+    parseLines(text.substr(first + 1, last - first), origin, offset + first + 1, result.chunk, ctx);
+    return result;
+}
+
+// decodes every record in [begin, end) of the mapped file, both record aligned, until any
+// thread has an error
+void loadPackedChunk(
+    const MappedFile& file, u64 begin, u64 end, DatasetChunk& chunk, const ParseContext& ctx)
+{
+    EvalFn eval(chunk.coefficients);
+    Board board;
+    auto decode =
+        ctx.options.format == DatasetFormat::MARLINFORMAT ? decodeMarlinformat : decodeBulletformat;
+    for (u64 offset = begin; offset < end && !ctx.error.failed(); offset += PACKED_RECORD_SIZE)
+    {
+        i32 score;
+        double wdl;
+        if (!decode(file.data() + offset, board, score, wdl, ctx.options.validateFens))
+        {
+            ctx.error.set("Invalid record at offset " + std::to_string(offset));
+            return;
+        }
+        addPosition(board, score, wdl, offset, eval, chunk, ctx);
+        reportLoaded(ctx.loadedPositions);
+    }
+}
+
+// groups positions by key in order of first appearance, and each group into variants with
+// the same wdl and score. every group's coefficients are stored once, and its variants
+// follow each other so coefficient offsets never decrease between positions
+Dataset deduplicate(const Dataset& dataset, std::span<const u64> keys)
+{
+    std::unordered_map<u64, u32> groupIndices;
+    std::unordered_map<u64, u32> variantIndices;
+    std::vector<u32> groupFirst;
+    std::vector<u32> variantFirst;
+    std::vector<u32> variantGroup;
+    std::vector<float> variantWeight;
+    groupIndices.reserve(dataset.positions.size());
+    variantIndices.reserve(dataset.positions.size());
+
+    for (u32 i = 0; i < dataset.positions.size(); i++)
+    {
+        const Position& pos = dataset.positions[i];
+        auto [groupIt, newGroup] = groupIndices.try_emplace(keys[i], groupFirst.size());
+        if (newGroup)
+            groupFirst.push_back(i);
+        u32 group = groupIt->second;
+
+        // the phase follows from the key, so only the wdl and score can differ
+        u64 variantKey = (static_cast<u64>(group) << 24) | (static_cast<u64>(pos.wdlPhase & 3) << 16)
+            | static_cast<u16>(pos.score);
+        auto [variantIt, newVariant] = variantIndices.try_emplace(variantKey, variantFirst.size());
+        if (newVariant)
+        {
+            variantFirst.push_back(i);
+            variantGroup.push_back(group);
+            variantWeight.push_back(0.0f);
         }
-        if (wdlResult == -1.0)
+        variantWeight[variantIt->second] += 1.0f;
+    }
+
+    // counting sort of the variants by group, stable so the file order is kept otherwise
+    std::vector<u32> groupOffsets(groupFirst.size() + 1, 0);
+    for (u32 group : variantGroup)
+        groupOffsets[group + 1]++;
+    for (usize group = 0; group < groupFirst.size(); group++)
+        groupOffsets[group + 1] += groupOffsets[group];
+    std::vector<u32> order(variantFirst.size());
+    for (u32 variant = 0; variant < variantFirst.size(); variant++)
+        order[groupOffsets[variantGroup[variant]]++] = variant;
+
+    Dataset result;
+    result.positions.reserve(variantFirst.size());
+    result.weights.reserve(variantFirst.size());
+    u64 groupCoeffBegin = 0;
+    u32 prevGroup = UINT32_MAX;
+    for (u32 variant : order)
+    {
+        u32 group = variantGroup[variant];
+        if (group != prevGroup)
         {
-            std::cout << "Warning: line with no wdl marker, defaulting to 0.5" << std::endl;
-            wdlResult = 0.5;
+            const Position& first = dataset.positions[groupFirst[group]];
+            groupCoeffBegin = result.allCoefficients.size();
+            result.allCoefficients.insert(result.allCoefficients.end(),
+                dataset.allCoefficients.begin() + first.coeffBegin,
+                dataset.allCoefficients.begin() + first.coeffBegin + first.coeffCount());
+            prevGroup = group;
         }
+        Position pos = dataset.positions[variantFirst[variant]];
+        pos.coeffBegin = groupCoeffBegin;
+        result.positions.push_back(pos);
+        result.weights.push_back(variantWeight[variant]);
+    }
+
+    std::cout << "Deduplicated " << dataset.positions.size() << " positions into "
+              << result.positions.size() << " weighted positions with " << groupFirst.size()
+              << " unique coefficient sets (" << dataset.allCoefficients.size() << " -> "
+              << result.allCoefficients.size() << " coefficients)" << std::endl;
+    return result;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::duration<double>>(elapsed).count();
+}
 
-        // will overflow to 0
-        size_t sixthSpace = SIZE_MAX;
-        for (i32 i = 0; i < 6; i++)
+// * matches any run of characters and ? any single character
+bool globMatch(std::string_view pattern, std::string_view name)
+{
+    usize p = 0, n = 0;
+    // position after the last * in pattern, and where it started matching in name
+    usize starP = std::string_view::npos, starN = 0;
+    while (n < name.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+        {
+            p++;
+            n++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
         {
-            sixthSpace = line.find(' ', sixthSpace + 1);
-            if (sixthSpace == std::string::npos)
+            starP = ++p;
+            starN = n;
+        }
+        else if (starP != std::string_view::npos)
+        {
+            p = starP;
+            n = ++starN;
+        }
+        else
+            return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+// regular files in dir whose name matches pattern, sorted so the order is reproducible
+std::vector<std::string> listFiles(const std::filesystem::path& dir, std::string_view pattern)
+{
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (entry.is_regular_file() && !name.starts_with('.') && globMatch(pattern, name))
+            files.push_back(entry.path().string());
+    }
+    if (ec)
+    {
+        std::cout << "Error: Could not list directory: " << dir.string() << std::endl;
+        exit(1);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::vector<DatasetShard> resolveDatasetShards(const std::string& spec)
+{
+    std::vector<DatasetShard> shards;
+    std::string_view rest = spec;
+    while (!rest.empty())
+    {
+        std::string_view entry = rest.substr(0, rest.find(','));
+        rest.remove_prefix(std::min(rest.size(), entry.size() + 1));
+        if (entry.empty())
+            continue;
+
+        DatasetShard options;
+        std::string pattern(entry.substr(0, entry.find('@')));
+        entry.remove_prefix(pattern.size());
+        while (!entry.empty())
+        {
+            entry.remove_prefix(1);
+            std::string_view option = entry.substr(0, entry.find('@'));
+            entry.remove_prefix(option.size());
+            std::string_view key = option.substr(0, option.find('='));
+            std::string_view value = option.substr(std::min(option.size(), key.size() + 1));
+            const char* valueEnd = value.data() + value.size();
+
+            std::from_chars_result result = {};
+            if (key == "ratio")
+                result = std::from_chars(value.data(), valueEnd, options.ratio);
+            else if (key == "max")
+                result = std::from_chars(value.data(), valueEnd, options.maxPositions);
+            if (value.empty() || result.ec != std::errc() || result.ptr != valueEnd
+                || !(options.ratio > 0.0 && options.ratio <= 1.0))
             {
-                std::cout << "Error: Invalid data: " << line << std::endl;
+                std::cout << "Error: Invalid dataset option: " << option << std::endl;
                 exit(1);
             }
         }
 
-        size_t firstBar = line.find('|');
-        if (firstBar == std::string::npos)
+        std::vector<std::string> files;
+        std::filesystem::path path(pattern);
+        if (pattern.find_first_of("*?") != std::string::npos)
         {
-            std::cout << "Error: Invalid data: " << line << std::endl;
+            std::filesystem::path dir = path.parent_path();
+            files = listFiles(dir.empty() ? "." : dir, path.filename().string());
+        }
+        else if (std::filesystem::is_directory(path))
+            files = listFiles(path, "*");
+        else
+            files.push_back(pattern);
+        if (files.empty())
+        {
+            std::cout << "Error: No dataset files match " << pattern << std::endl;
             exit(1);
         }
 
-        i32 score;
-        auto [ptr, ec] =
-            std::from_chars(line.c_str() + firstBar + 2, line.c_str() + line.size(), score);
-        if (ec != std::errc())
+        for (std::string& file : files)
         {
-            std::cout << "Error: Invalid Data, Could not parse score: " << line << std::endl;
+            options.filepath = std::move(file);
+            shards.push_back(options);
+        }
+    }
+    if (shards.empty())
+    {
+        std::cout << "Error: No dataset files given" << std::endl;
+        exit(1);
+    }
+    return shards;
+}
+
+// maps every shard and splits them into ranges for the loader threads
+std::vector<ShardFile> openShards(std::span<const DatasetShard> shards,
+    const DatasetLoadOptions& options, u32 concurrency, std::vector<LoadRange>& ranges)
+{
+    std::vector<ShardFile> files;
+    for (u32 i = 0; i < shards.size(); i++)
+    {
+        const DatasetShard& shard = shards[i];
+        auto file = std::make_unique<MappedFile>(shard.filepath);
+        if (!file->isOpen())
+        {
+            std::cout << "Error: Could not open dataset: " << shard.filepath << std::endl;
+            exit(1);
+        }
+        if (isDatasetCache(shard.filepath))
+        {
+            std::cout << "Error: Dataset caches can't be combined with other files: "
+                      << shard.filepath << std::endl;
             exit(1);
         }
 
-        Board board;
-        board.setToFen(std::string_view(line.begin(), line.begin() + sixthSpace));
+        u32 shardIdx = static_cast<u32>(files.size());
+        std::span<const u8> data(file->data(), file->size());
+        Compression compression = detectCompression(data);
+        if (compression != Compression::NONE)
+        {
+            if (!compressionSupported(compression))
+            {
+                std::cout << "Error: This build can't decompress " << compressionName(compression)
+                          << " datasets: " << shard.filepath << std::endl;
+                exit(1);
+            }
+            if (options.format != DatasetFormat::TEXT)
+            {
+                std::cout << "Error: Only text datasets can be compressed: " << shard.filepath
+                          << std::endl;
+                exit(1);
+            }
+            for (std::span<const u8> frames : splitFrames(compression, data, COMPRESSED_RANGE_SIZE))
+            {
+                u64 begin = static_cast<u64>(frames.data() - data.data());
+                ranges.push_back({shardIdx, begin, begin + frames.size()});
+            }
+        }
+        else if (options.format != DatasetFormat::TEXT)
+        {
+            if (data.size() % PACKED_RECORD_SIZE != 0)
+            {
+                std::cout << "Error: Dataset size is not a multiple of " << PACKED_RECORD_SIZE
+                          << " bytes: " << shard.filepath << std::endl;
+                exit(1);
+            }
+            u64 numRecords = data.size() / PACKED_RECORD_SIZE;
+            u64 numRanges = std::clamp<u64>(data.size() / MIN_RANGE_SIZE, 1, concurrency * 4);
+            for (u64 j = 0; j < numRanges; j++)
+                ranges.push_back({shardIdx, numRecords * j / numRanges * PACKED_RECORD_SIZE,
+                    numRecords * (j + 1) / numRanges * PACKED_RECORD_SIZE});
+        }
+        else
+        {
+            // more ranges than threads so uneven ranges still balance out
+            u64 numRanges = std::clamp<u64>(data.size() / MIN_RANGE_SIZE, 1, concurrency * 4);
+            for (u64 j = 0; j < numRanges; j++)
+                ranges.push_back(
+                    {shardIdx, data.size() * j / numRanges, data.size() * (j + 1) / numRanges});
+        }
+        files.push_back({&shard, std::move(file), compression});
+    }
+    return files;
+}
+
+// every thread takes the next range, parsing it directly if it isn't compressed. compressed
+// ranges are decompressed in blocks that any thread can parse, so both stages overlap and
+// a range that can't be split further is parsed by all threads while one decompresses it.
+// the chunks come out in file order, with the shard each belongs to in chunkShards.
+// after an error of any thread the others stop early, and it is reported here
+std::vector<DatasetChunk> loadShards(ThreadPool& threadPool, std::span<const ShardFile> files,
+    std::span<const LoadRange> ranges, std::span<const ParseContext> contexts, LoadError& error,
+    std::vector<u32>& chunkShards)
+{
+    auto t1 = std::chrono::steady_clock::now();
+
+    // bounded so decompression can't run far ahead of parsing
+    const usize maxQueued = 2 * threadPool.concurrency();
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<TextBlock> queue;
+    u32 nextRange = 0;
+    u32 activeDecompressors = 0;
+    std::map<std::pair<u32, u32>, ParsedBlock> parsedBlocks;
+
+    std::atomic_uint64_t compressedBytes = 0;
+    std::atomic_uint64_t decompressedBytes = 0;
+    // summed over all threads
+    std::atomic<double> decompressSeconds = 0;
+    std::atomic<double> parseSeconds = 0;
+
+    auto finish = [&](u32 range, u32 index, ParsedBlock&& parsed)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        parsedBlocks.emplace(std::make_pair(range, index), std::move(parsed));
+    };
+
+    // the ranges of a compressed file are the same however many threads there are
+    auto rangeOrigin = [&](u32 rangeIdx)
+    {
+        return murmurHash3(ranges[rangeIdx].begin);
+    };
+
+    auto parse = [&](TextBlock& block)
+    {
+        auto start = std::chrono::steady_clock::now();
+        ParsedBlock parsed = parseBlock(block.text, rangeOrigin(block.range), block.offset,
+            contexts[ranges[block.range].shard]);
+        block.text = {};
+        parseSeconds += secondsSince(start);
+        finish(block.range, block.index, std::move(parsed));
+    };
+
+    auto decompressRange = [&](u32 rangeIdx)
+    {
+        const LoadRange& range = ranges[rangeIdx];
+        const ShardFile& file = files[range.shard];
+        std::span<const u8> frames(file.file->data() + range.begin, range.end - range.begin);
+        compressedBytes += frames.size();
+
+        u32 index = 0;
+        u64 offset = 0;
+        auto start = std::chrono::steady_clock::now();
+        bool intact = decompress(file.compression, frames, DECOMPRESSED_BLOCK_SIZE,
+            [&](std::string&& text)
+            {
+                decompressSeconds += secondsSince(start);
+                decompressedBytes += text.size();
+                if (error.failed())
+                    return;
+                u64 textSize = text.size();
+                TextBlock block = {rangeIdx, index++, offset, std::move(text)};
+                offset += textSize;
+
+                std::unique_lock<std::mutex> lock(mutex);
+                if (queue.size() < maxQueued)
+                {
+                    queue.push_back(std::move(block));
+                    lock.unlock();
+                    cv.notify_one();
+                }
+                else
+                {
+                    // nobody is keeping up, parse it here instead of waiting
+                    lock.unlock();
+                    parse(block);
+                }
+                start = std::chrono::steady_clock::now();
+            });
+        decompressSeconds += secondsSince(start);
+        if (!intact)
+            error.set(std::string("Corrupt ") + compressionName(file.compression)
+                + " data: " + file.shard->filepath);
+    };
+
+    auto loadRange = [&](u32 rangeIdx)
+    {
+        const LoadRange& range = ranges[rangeIdx];
+        const MappedFile& file = *files[range.shard].file;
+        const ParseContext& ctx = contexts[range.shard];
+        auto start = std::chrono::steady_clock::now();
+        ParsedBlock parsed;
+        parsed.hasNewline = true;
+        if (ctx.options.format == DatasetFormat::TEXT)
+            loadChunk(file, range.begin, range.end, parsed.chunk, ctx);
+        else
+            loadPackedChunk(file, range.begin, range.end, parsed.chunk, ctx);
+        parseSeconds += secondsSince(start);
+        finish(rangeIdx, 0, std::move(parsed));
+    };
+
+    threadPool.run(
+        [&](u32)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                if (!queue.empty())
+                {
+                    TextBlock block = std::move(queue.front());
+                    queue.pop_front();
+                    lock.unlock();
+                    parse(block);
+                    lock.lock();
+                }
+                else if (nextRange < ranges.size() && !error.failed())
+                {
+                    u32 range = nextRange++;
+                    if (files[ranges[range].shard].compression == Compression::NONE)
+                    {
+                        lock.unlock();
+                        loadRange(range);
+                        lock.lock();
+                        continue;
+                    }
+                    activeDecompressors++;
+                    lock.unlock();
+                    decompressRange(range);
+                    lock.lock();
+                    activeDecompressors--;
+                    cv.notify_all();
+                }
+                else if (activeDecompressors == 0)
+                    break;
+                else
+                    cv.wait(lock);
+            }
+        });
+    error.check();
+
+    // join the lines split between blocks, in file order
+    std::vector<DatasetChunk> chunks;
+    std::string pending;
+    u32 pendingShard = 0;
+    // where the line in pending starts
+    u64 pendingOrigin = 0;
+    u64 pendingOffset = 0;
+    auto parseJoined = [&]()
+    {
+        if (pending.empty())
+            return;
+        chunks.emplace_back();
+        chunkShards.push_back(pendingShard);
+        parseLines(pending, pendingOrigin, pendingOffset, chunks.back(), contexts[pendingShard]);
+        pending.clear();
+    };
+    for (auto& [key, block] : parsedBlocks)
+    {
+        u32 shard = ranges[key.first].shard;
+        if (shard != pendingShard)
+            parseJoined();
+        pendingShard = shard;
 
-        auto [coeffBegin, coeffEnd, egScale] = eval.getCoefficients(board);
+        if (pending.empty())
+        {
+            pendingOrigin = rangeOrigin(key.first);
+            pendingOffset = block.offset;
+        }
+        pending += block.head;
+        if (!block.hasNewline)
+            continue;
+        parseJoined();
+        chunks.push_back(std::move(block.chunk));
+        chunkShards.push_back(shard);
+        pending = std::move(block.tail);
+        pendingOrigin = rangeOrigin(key.first);
+        pendingOffset = block.tailOffset;
+    }
+    parseJoined();
+    error.check();
 
-        Position pos;
-        pos.coeffBegin = coeffBegin;
-        pos.coeffEnd = coeffEnd;
-        pos.score = score;
-        pos.wdl = wdlResult;
-        pos.phase = 4 * board.pieces(PieceType::QUEEN).popcount()
-            + 2 * board.pieces(PieceType::ROOK).popcount()
-            + board.pieces(PieceType::BISHOP).popcount() + board.pieces(PieceType::KNIGHT).popcount();
-        pos.phase /= 24.0;
-        pos.egScale = egScale;
+    constexpr double MB = 1024.0 * 1024.0;
+    // every context counts into the same total
+    u64 loaded = contexts.empty() ? 0 : contexts[0].loadedPositions.load();
+    double seconds = secondsSince(t1);
+    const char* unit = contexts.empty() || contexts[0].options.format == DatasetFormat::TEXT
+        ? " lines"
+        : " records";
+    if (compressedBytes > 0)
+        std::cout << "Decompressed " << static_cast<double>(compressedBytes) / MB << " MB to "
+                  << static_cast<double>(decompressedBytes) / MB << " MB in "
+                  << decompressSeconds << "s of thread time ("
+                  << static_cast<double>(decompressedBytes) / MB / decompressSeconds
+                  << " MB/s per thread)" << std::endl;
+    std::cout << "Parsing took " << parseSeconds << "s of thread time ("
+              << static_cast<double>(loaded) / parseSeconds << unit << "/s per thread)"
+              << std::endl;
+    std::cout << "Parsed " << loaded << unit << " from " << files.size() << " files in "
+              << seconds << "s (" << static_cast<double>(loaded) / seconds << unit << "/s)"
+              << std::endl;
+    return chunks;
+}
 
-        positions.push_back(pos);
+// traces the sampled boards, in chunks that each belong to one shard
+std::vector<DatasetChunk> traceReservoir(ThreadPool& threadPool, PositionReservoir& reservoir,
+    const DatasetLoadOptions& options, LoadStats& stats, LoadError& error,
+    std::vector<u32>& chunkShards)
+{
+    std::vector<PositionReservoir::Entry> entries = reservoir.take();
 
-        if (positions.size() % 65536 == 0)
-            std::cout << "Loaded " << positions.size() << " positions " << std::endl;
+    // split at every shard boundary and into several chunks per thread
+    std::vector<usize> chunkBegins;
+    usize maxChunkSize = std::max<usize>(entries.size() / (threadPool.concurrency() * 4), 1);
+    chunkShards.clear();
+    for (usize i = 0; i < entries.size(); i++)
+    {
+        if (i == 0 || entries[i].shard != entries[i - 1].shard
+            || i - chunkBegins.back() >= maxChunkSize)
+        {
+            chunkBegins.push_back(i);
+            chunkShards.push_back(entries[i].shard);
+        }
     }
-    return {allCoefficients, positions};
+    chunkBegins.push_back(entries.size());
+
+    std::vector<DatasetChunk> chunks(chunkShards.size());
+    std::atomic_uint64_t tracedPositions = 0;
+    threadPool.parallelFor(0, chunks.size(),
+        [&](u32, usize firstChunk, usize lastChunk)
+        {
+            Board board;
+            for (usize i = firstChunk; i < lastChunk; i++)
+            {
+                DatasetChunk& chunk = chunks[i];
+                EvalFn eval(chunk.coefficients);
+                // already sampled and filtered
+                DatasetLoadOptions traceOptions;
+                traceOptions.resolvePly = options.resolvePly;
+                ParseContext ctx = {traceOptions, chunkShards[i], true, 0, 0, tracedPositions,
+                    stats, error, nullptr};
+                for (usize j = chunkBegins[i]; j < chunkBegins[i + 1]; j++)
+                {
+                    i32 score;
+                    double wdl;
+                    decodeMarlinformat(entries[j].record.data(), board, score, wdl, false);
+                    addPosition(board, score, wdl, 0, eval, chunk, ctx);
+                }
+            }
+        });
+    return chunks;
+}
+
+// keeps only the positions of chunk with keep[offset + i] set, and their coefficients
+void compactChunk(DatasetChunk& chunk, const std::vector<bool>& keep, usize offset)
+{
+    DatasetChunk result;
+    for (usize i = 0; i < chunk.positions.size(); i++)
+    {
+        if (!keep[offset + i])
+            continue;
+        Position pos = chunk.positions[i];
+        auto coeffs = chunk.coefficients.begin() + pos.coeffBegin;
+        pos.coeffBegin = result.coefficients.size();
+        result.coefficients.insert(result.coefficients.end(), coeffs, coeffs + pos.coeffCount());
+        result.positions.push_back(pos);
+        result.keys.push_back(chunk.keys[i]);
+    }
+    chunk = std::move(result);
+}
+
+// keeps a random maxPositions positions of every shard with more, in file order
+void capShards(std::span<const ShardFile> files, std::vector<DatasetChunk>& chunks,
+    std::span<const u32> chunkShards)
+{
+    std::vector<usize> shardSizes(files.size(), 0);
+    for (usize i = 0; i < chunks.size(); i++)
+        shardSizes[chunkShards[i]] += chunks[i].positions.size();
+
+    for (u32 shard = 0; shard < files.size(); shard++)
+    {
+        u64 maxPositions = files[shard].shard->maxPositions;
+        usize size = shardSizes[shard];
+        if (maxPositions == 0 || size <= maxPositions)
+            continue;
+
+        // first maxPositions entries of a seeded fisher-yates shuffle
+        std::vector<u32> indices(size);
+        std::iota(indices.begin(), indices.end(), 0);
+        PRNG prng;
+        prng.seed(murmurHash3(shard + 1));
+        std::vector<bool> keep(size, false);
+        for (usize i = 0; i < maxPositions; i++)
+        {
+            usize j = i + prng.next64() % (size - i);
+            std::swap(indices[i], indices[j]);
+            keep[indices[i]] = true;
+        }
+
+        usize offset = 0;
+        for (usize i = 0; i < chunks.size(); i++)
+        {
+            if (chunkShards[i] != shard)
+                continue;
+            usize chunkSize = chunks[i].positions.size();
+            compactChunk(chunks[i], keep, offset);
+            offset += chunkSize;
+        }
+        std::cout << "Kept " << maxPositions << " of " << size << " positions from "
+                  << files[shard].shard->filepath << std::endl;
+    }
+}
+
+// concatenates the chunks in order, rebasing each chunk's coefficient offsets
+Dataset mergeChunks(
+    ThreadPool& threadPool, std::vector<DatasetChunk>& chunks, const DatasetLoadOptions& options)
+{
+    usize numChunks = chunks.size();
+    std::vector<size_t> positionOffsets(numChunks + 1, 0);
+    std::vector<size_t> coefficientOffsets(numChunks + 1, 0);
+    for (usize i = 0; i < numChunks; i++)
+    {
+        positionOffsets[i + 1] = positionOffsets[i] + chunks[i].positions.size();
+        coefficientOffsets[i + 1] = coefficientOffsets[i] + chunks[i].coefficients.size();
+    }
+
+    Dataset dataset;
+    dataset.positions.resize(positionOffsets.back());
+    dataset.allCoefficients.resize(coefficientOffsets.back());
+    std::vector<u64> keys(options.dedup ? positionOffsets.back() : 0);
+
+    threadPool.parallelFor(0, numChunks,
+        [&](u32, usize firstChunk, usize lastChunk)
+        {
+            for (usize i = firstChunk; i < lastChunk; i++)
+            {
+                DatasetChunk& chunk = chunks[i];
+                for (size_t j = 0; j < chunk.positions.size(); j++)
+                {
+                    Position pos = chunk.positions[j];
+                    pos.coeffBegin += coefficientOffsets[i];
+                    dataset.positions[positionOffsets[i] + j] = pos;
+                }
+                std::copy(chunk.coefficients.begin(), chunk.coefficients.end(),
+                    dataset.allCoefficients.begin() + coefficientOffsets[i]);
+                if (options.dedup)
+                    std::copy(chunk.keys.begin(), chunk.keys.end(), keys.begin() + positionOffsets[i]);
+
+                chunk = {};
+            }
+        });
+
+    std::cout << "Loaded " << dataset.positions.size() << " positions" << std::endl;
+    if (options.dedup)
+        return deduplicate(dataset, keys);
+    return dataset;
+}
+
+i64 parseDatasetText(std::string_view text, bool validateFens)
+{
+    Board board;
+    i64 lines = 0;
+    const char* lineBegin = text.data();
+    const char* end = text.data() + text.size();
+    while (lineBegin < end)
+    {
+        const char* lineEnd = findChar(lineBegin, end, '\n');
+        std::string_view line(lineBegin, lineEnd);
+        lineBegin = lineEnd + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            continue;
+
+        i32 score;
+        double wdl;
+        if (parseFields(line, validateFens, board, score, wdl))
+            return -1;
+        lines++;
+    }
+    return lines;
+}
+
+Dataset loadDataset(
+    ThreadPool& threadPool, const std::string& filepath, const DatasetLoadOptions& options)
+{
+    std::vector<DatasetShard> shards = resolveDatasetShards(filepath);
+    std::vector<LoadRange> ranges;
+    std::vector<ShardFile> files = openShards(shards, options, threadPool.concurrency(), ranges);
+
+    std::atomic_uint64_t loadedPositions = 0;
+    LoadStats stats;
+    LoadError error;
+    std::unique_ptr<PositionReservoir> reservoir;
+    if (options.sampleSize > 0)
+        reservoir = std::make_unique<PositionReservoir>(options.sampleSize);
+
+    std::vector<ParseContext> contexts;
+    bool sampling = false;
+    for (u32 i = 0; i < files.size(); i++)
+    {
+        double ratio = files[i].shard->ratio;
+        sampling |= ratio < 1.0;
+        contexts.push_back({options, i, ratio >= 1.0, static_cast<u64>(std::ldexp(ratio, 64)),
+            murmurHash3(i + 1), loadedPositions, stats, error, reservoir.get()});
+    }
+
+    std::vector<u32> chunkShards;
+    std::vector<DatasetChunk> chunks =
+        loadShards(threadPool, files, ranges, contexts, error, chunkShards);
+    if (options.skipInCheck || options.skipNoisy || options.maxScore > 0 || options.minPly > 0)
+        std::cout << "Filtered out " << stats.inCheck << " in check, " << stats.noisy
+                  << " noisy, " << stats.score << " by score and " << stats.ply << " by ply"
+                  << std::endl;
+    if (reservoir)
+        chunks = traceReservoir(threadPool, *reservoir, options, stats, error, chunkShards);
+    if (options.resolvePly > 0)
+    {
+        u64 resolved = stats.resolved;
+        std::cout << "Resolved " << resolved << " noisy positions to a quiet leaf, "
+                  << (resolved ? static_cast<double>(stats.resolvedPlies) / resolved : 0.0)
+                  << " plies on average" << std::endl;
+    }
+
+    if (sampling || reservoir)
+    {
+        usize sampled = 0;
+        for (const DatasetChunk& chunk : chunks)
+            sampled += chunk.positions.size();
+        std::cout << "Sampled " << sampled << " of " << loadedPositions << " positions"
+                  << std::endl;
+    }
+    capShards(files, chunks, chunkShards);
+    return mergeChunks(threadPool, chunks, options);
+}
+
+bool isDatasetCache(const std::string& filepath)
+{
+    std::ifstream file(filepath, std::ios::binary);
+    u64 magic = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    return file && magic == DATASET_CACHE_MAGIC;
+}
+
+void saveDatasetCache(const Dataset& dataset, const std::string& filepath)
+{
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Error: Could not open dataset cache for writing: " << filepath << std::endl;
+        exit(1);
+    }
+
+    DatasetCacheHeader header = {};
+    header.magic = DATASET_CACHE_MAGIC;
+    header.version = DATASET_CACHE_VERSION;
+    header.layoutHash = EvalFn::traceLayoutHash();
+    header.numPositions = dataset.positions.size();
+    header.numCoefficients = dataset.allCoefficients.size();
+    header.numWeights = dataset.weights.size();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(dataset.positions.data()),
+        dataset.positions.size() * sizeof(Position));
+    file.write(reinterpret_cast<const char*>(dataset.allCoefficients.data()),
+        dataset.allCoefficients.size() * sizeof(Coefficient));
+    file.write(reinterpret_cast<const char*>(dataset.weights.data()),
+        dataset.weights.size() * sizeof(float));
+
+    if (!file)
+    {
+        std::cout << "Error: Failed writing dataset cache: " << filepath << std::endl;
+        exit(1);
+    }
+}
+
+void validateDatasetCache(
+    const DatasetCacheHeader& header, usize fileSize, const std::string& filepath)
+{
+    if (header.magic != DATASET_CACHE_MAGIC)
+    {
+        std::cout << "Error: Not a dataset cache: " << filepath << std::endl;
+        exit(1);
+    }
+    if (header.version != DATASET_CACHE_VERSION)
+    {
+        std::cout << "Error: Dataset cache version " << header.version << " does not match "
+                  << DATASET_CACHE_VERSION << ", rebuild it with extract" << std::endl;
+        exit(1);
+    }
+    if (header.layoutHash != EvalFn::traceLayoutHash())
+    {
+        std::cout << "Error: Dataset cache was extracted with a different eval parameter layout, "
+                     "rebuild it with extract"
+                  << std::endl;
+        exit(1);
+    }
+
+    usize positionBytes = header.numPositions * sizeof(Position);
+    usize coefficientBytes = header.numCoefficients * sizeof(Coefficient);
+    usize weightBytes = header.numWeights * sizeof(float);
+    if ((header.numWeights != 0 && header.numWeights != header.numPositions)
+        || fileSize != sizeof(header) + positionBytes + coefficientBytes + weightBytes)
+    {
+        std::cout << "Error: Dataset cache is truncated or corrupt: " << filepath << std::endl;
+        exit(1);
+    }
+}
+
+Dataset loadDatasetCache(const std::string& filepath)
+{
+    // read straight into the vectors, a mapping would have to be copied out of in full
+    std::ifstream file(filepath, std::ios::binary);
+    std::error_code ec;
+    usize fileSize = std::filesystem::file_size(filepath, ec);
+    DatasetCacheHeader header;
+    if (!file || ec || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        std::cout << "Error: Could not open dataset cache: " << filepath << std::endl;
+        exit(1);
+    }
+    validateDatasetCache(header, fileSize, filepath);
+
+    Dataset dataset;
+    dataset.positions.resize(header.numPositions);
+    dataset.allCoefficients.resize(header.numCoefficients);
+    dataset.weights.resize(header.numWeights);
+    file.read(reinterpret_cast<char*>(dataset.positions.data()),
+        header.numPositions * sizeof(Position));
+    file.read(reinterpret_cast<char*>(dataset.allCoefficients.data()),
+        header.numCoefficients * sizeof(Coefficient));
+    file.read(reinterpret_cast<char*>(dataset.weights.data()), header.numWeights * sizeof(float));
+    if (!file)
+    {
+        std::cout << "Error: Failed reading dataset cache: " << filepath << std::endl;
+        exit(1);
+    }
+
+    std::cout << "Loaded " << dataset.positions.size() << " positions from dataset cache"
+              << std::endl;
+    return dataset;
 }
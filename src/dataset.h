@@ -1,33 +1,196 @@
 #pragma once
 
+#include "aligned_allocator.h"
 #include "sirius/defs.h"
+#include "sirius/util/enum_array.h"
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <fstream>
 #include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
+// NORMAL: white - black
+// SAFETY: the trace value of one side
+// COMPLEXITY: the white trace value
 struct Coefficient
 {
     i16 index;
-    i16 white;
-    i16 black;
+    i16 value;
 };
 
+constexpr i32 PHASE_DENOMINATOR = 24;
+// promoted pieces can take the phase past PHASE_DENOMINATOR, anything above this is clamped
+constexpr i32 MAX_PHASE = 63;
+constexpr i32 EG_SCALE_DENOMINATOR = 128;
+
+constexpr std::array<double, 3> WDL_VALUES = {0.0, 0.5, 1.0};
+constexpr std::array<double, MAX_PHASE + 1> PHASE_VALUES = []()
+{
+    std::array<double, MAX_PHASE + 1> values = {};
+    for (i32 i = 0; i <= MAX_PHASE; i++)
+        values[i] = i / static_cast<double>(PHASE_DENOMINATOR);
+    return values;
+}();
+
+// each position's coefficients are stored contiguously starting at coeffBegin,
+// split into segments by param type in this order:
+// normal, white safety, black safety, complexity
+// wdl, phase and eg scale only take a few values, so they are stored as small integers
+// and decoded with the tables above
+// coeffBegin is 64 bit, a few hundred million positions have more coefficients than a
+// 32 bit offset can address
 struct Position
 {
-    i32 coeffBegin;
-    i32 coeffEnd;
-    i32 score;
-    double wdl;
-    double phase;
-    double egScale;
+    u64 coeffBegin;
+    u8 normalCount;
+    ColorArray<u8> safetyCount;
+    u8 complexityCount;
+    // clamped to the range of an i16
+    i16 score;
+    // low 2 bits are the wdl in half points, the rest is the phase
+    u8 wdlPhase;
+    // out of EG_SCALE_DENOMINATOR
+    u8 egScaleFactor;
+
+    double wdl() const
+    {
+        return WDL_VALUES[wdlPhase & 3];
+    }
+
+    double phase() const
+    {
+        return PHASE_VALUES[wdlPhase >> 2];
+    }
+
+    double egScale() const
+    {
+        return egScaleFactor / static_cast<double>(EG_SCALE_DENOMINATOR);
+    }
+
+    i32 coeffCount() const
+    {
+        return normalCount + safetyCount[Color::WHITE] + safetyCount[Color::BLACK]
+            + complexityCount;
+    }
+
+    // wdl is 0, 0.5 or 1, phase is in [0, MAX_PHASE]
+    void setWdlPhase(double wdl, i32 phase)
+    {
+        wdlPhase = static_cast<u8>(static_cast<i32>(wdl * 2) | (phase << 2));
+    }
+
+    void setScore(i32 value)
+    {
+        score = static_cast<i16>(std::clamp<i32>(value, INT16_MIN, INT16_MAX));
+    }
 };
 
+static_assert(sizeof(Position) == 16);
+
 struct Dataset
 {
-    std::vector<Coefficient> allCoefficients;
-    std::vector<Position> positions;
+    std::vector<Coefficient, AlignedAllocator<Coefficient>> allCoefficients;
+    std::vector<Position, AlignedAllocator<Position>> positions;
+    // how many times each position appeared, empty unless the dataset was deduplicated
+    std::vector<float, AlignedAllocator<float>> weights;
+};
+
+// number of positions the weights stand for, weights is empty if there are none
+inline double sumWeights(usize numPositions, std::span<const float> weights)
+{
+    if (weights.empty())
+        return static_cast<double>(numPositions);
+    double sum = 0;
+    for (float weight : weights)
+        sum += weight;
+    return sum;
+}
+
+// binary dataset cache
+// header, followed by the raw positions, the raw coefficients and then the raw weights
+struct DatasetCacheHeader
+{
+    u64 magic;
+    u32 version;
+    u32 reserved;
+    // hash of the trace/parameter layout the coefficients were extracted with
+    u64 layoutHash;
+    u64 numPositions;
+    u64 numCoefficients;
+    // 0 or numPositions
+    u64 numWeights;
 };
 
-Dataset loadDataset(std::ifstream& file);
+constexpr u64 DATASET_CACHE_MAGIC = 0x3245484341434453; // "SDCACHE2"
+constexpr u32 DATASET_CACHE_VERSION = 5;
+
+class ThreadPool;
+
+enum class DatasetFormat
+{
+    // fen | score | wdl lines
+    TEXT,
+    // 32 byte records, see packed_formats.h
+    MARLINFORMAT,
+    BULLETFORMAT
+};
+
+struct DatasetLoadOptions
+{
+    DatasetFormat format = DatasetFormat::TEXT;
+    // positions with the same zobrist key share their coefficients, and the ones that
+    // also have the same wdl and score are merged into one weighted position
+    bool dedup = false;
+    // exit with an error on invalid fens or records instead of assuming they are valid
+    bool validateFens = false;
+
+    // filters applied after the fen is loaded and before the position is traced
+    bool skipInCheck = false;
+    // the side to move has a legal capture or promotion that doesn't lose material
+    bool skipNoisy = false;
+    // 0 keeps every score
+    i32 maxScore = 0;
+    // bulletformat has no move counters, so its positions always pass
+    i32 minPly = 0;
+    // keep a uniform random sample of this many of the positions that pass the filters,
+    // 0 keeps all of them. only a packed copy of the sampled boards is kept while loading,
+    // they are traced once every file has been read
+    u64 sampleSize = 0;
+    // replace every position with the leaf of a material only quiescence search of at most
+    // this many plies before tracing it, 0 traces the positions as they are
+    i32 resolvePly = 0;
+};
+
+// one file of a dataset spec
+struct DatasetShard
+{
+    std::string filepath;
+    // fraction of the positions to keep, chosen by a hash of their zobrist key and record id
+    double ratio = 1.0;
+    // keep a random subset of at most this many of the sampled positions, 0 for no limit
+    u64 maxPositions = 0;
+};
+
+// spec is a comma separated list of files, directories and globs (* and ? in the file name),
+// each optionally followed by @ratio=<fraction> and @max=<positions> for every file in it,
+// e.g. "selfplay/*.epd.zst@ratio=0.25,lichess@max=1000000,extra.epd"
+std::vector<DatasetShard> resolveDatasetShards(const std::string& spec);
+
+// loads every shard of a dataset spec concurrently and merges them in order
+Dataset loadDataset(
+    ThreadPool& threadPool, const std::string& spec, const DatasetLoadOptions& options);
+
+// parses the fen | score | wdl lines of text like loadDataset does, without tracing them.
+// returns the number of lines, or -1 at an invalid one. only used to benchmark the parser
+i64 parseDatasetText(std::string_view text, bool validateFens);
+
+bool isDatasetCache(const std::string& filepath);
+void saveDatasetCache(const Dataset& dataset, const std::string& filepath);
+// exits with an error if the cache can't be used with this build
+void validateDatasetCache(
+    const DatasetCacheHeader& header, usize fileSize, const std::string& filepath);
+Dataset loadDatasetCache(const std::string& filepath);
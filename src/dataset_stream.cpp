@@ -0,0 +1,282 @@
+#include "dataset_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace
+{
+
+// positions are read in blocks of this many when planning the chunks
+constexpr usize READ_BLOCK_SIZE = 16384;
+
+constexpr usize positionOffset(usize idx)
+{
+    return sizeof(DatasetCacheHeader) + idx * sizeof(Position);
+}
+
+}
+
+DatasetStream::DatasetStream(const std::string& filepath, usize batchSize, usize memoryBudget)
+    : m_Filepath(filepath), m_File(filepath, std::ios::binary | std::ios::ate)
+{
+    if (!m_File)
+    {
+        std::cout << "Error: Could not open dataset cache: " << filepath << std::endl;
+        exit(1);
+    }
+    usize fileSize = static_cast<usize>(m_File.tellg());
+    m_File.seekg(0);
+
+    DatasetCacheHeader header = {};
+    m_File.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!m_File)
+    {
+        std::cout << "Error: Could not open dataset cache: " << filepath << std::endl;
+        exit(1);
+    }
+    validateDatasetCache(header, fileSize, filepath);
+    m_NumPositions = header.numPositions;
+    m_NumCoefficients = header.numCoefficients;
+    m_HasWeights = header.numWeights != 0;
+
+    planChunks(batchSize, memoryBudget / 2);
+
+    // the buffers are sized once for the largest chunk, so memory use stays flat
+    usize maxPositions = 0, maxCoefficients = 0;
+    for (const Chunk& chunk : m_Chunks)
+    {
+        maxPositions = std::max(maxPositions, chunk.positionEnd - chunk.positionBegin);
+        maxCoefficients = std::max(maxCoefficients, chunk.coeffEnd - chunk.coeffBegin);
+    }
+    for (ChunkBuffer& buffer : m_Buffers)
+    {
+        buffer.positions.reserve(maxPositions);
+        buffer.coefficients.reserve(maxCoefficients);
+        if (m_HasWeights)
+            buffer.weights.reserve(maxPositions);
+    }
+
+    std::cout << "Streaming " << m_NumPositions << " positions in " << m_Chunks.size()
+              << " chunk(s) of up to " << maxPositions << " positions ("
+              << (maxPositions * (sizeof(Position) + (m_HasWeights ? sizeof(float) : 0))
+                     + maxCoefficients * sizeof(Coefficient))
+            / (1024 * 1024)
+              << " MiB per buffer)" << std::endl;
+
+    m_Loader = std::thread(
+        [this]()
+        {
+            loaderLoop();
+        });
+}
+
+DatasetStream::~DatasetStream()
+{
+    {
+        std::lock_guard lock(m_Mutex);
+        m_ShouldStop = true;
+    }
+    m_CV.notify_all();
+    m_Loader.join();
+}
+
+usize DatasetStream::weightOffset(usize idx) const
+{
+    return positionOffset(m_NumPositions) + m_NumCoefficients * sizeof(Coefficient)
+        + idx * sizeof(float);
+}
+
+void DatasetStream::planChunks(usize batchSize, usize bufferBytes)
+{
+    // only the coefficient range of each batch is needed, but every position has to be read.
+    // deduplicated positions can share coefficients with the next batch, so the ranges of
+    // neighbouring batches may overlap
+    std::vector<usize> batchCoeffBegins;
+    std::vector<usize> batchCoeffEnds;
+    std::vector<Position> block(READ_BLOCK_SIZE);
+    m_File.seekg(positionOffset(0));
+    for (usize begin = 0; begin < m_NumPositions; begin += READ_BLOCK_SIZE)
+    {
+        usize count = std::min(READ_BLOCK_SIZE, m_NumPositions - begin);
+        m_File.read(reinterpret_cast<char*>(block.data()), count * sizeof(Position));
+        for (usize i = 0; i < count; i++)
+        {
+            const Position& pos = block[i];
+            if ((begin + i) % batchSize == 0)
+            {
+                batchCoeffBegins.push_back(pos.coeffBegin);
+                batchCoeffEnds.push_back(pos.coeffBegin);
+            }
+            usize coeffEnd = pos.coeffBegin + pos.coeffCount();
+            batchCoeffEnds.back() = std::max(batchCoeffEnds.back(), coeffEnd);
+        }
+    }
+    if (m_HasWeights)
+    {
+        std::vector<float> weights(READ_BLOCK_SIZE);
+        m_File.seekg(weightOffset(0));
+        m_TotalWeight = 0;
+        for (usize begin = 0; begin < m_NumPositions; begin += READ_BLOCK_SIZE)
+        {
+            usize count = std::min(READ_BLOCK_SIZE, m_NumPositions - begin);
+            m_File.read(reinterpret_cast<char*>(weights.data()), count * sizeof(float));
+            m_TotalWeight += sumWeights(count, std::span(weights.data(), count));
+        }
+    }
+    else
+        m_TotalWeight = static_cast<double>(m_NumPositions);
+    if (!m_File)
+    {
+        std::cout << "Error: Failed reading dataset cache: " << m_Filepath << std::endl;
+        exit(1);
+    }
+
+    usize weightSize = m_HasWeights ? sizeof(float) : 0;
+    auto chunkBytes = [&](const Chunk& chunk)
+    {
+        return (chunk.positionEnd - chunk.positionBegin) * (sizeof(Position) + weightSize)
+            + (chunk.coeffEnd - chunk.coeffBegin) * sizeof(Coefficient);
+    };
+
+    usize numBatches = batchCoeffBegins.size();
+    Chunk chunk = {0, 0, 0, 0};
+    for (usize batch = 0; batch < numBatches; batch++)
+    {
+        Chunk extended = chunk;
+        if (extended.positionEnd == extended.positionBegin)
+            extended.coeffBegin = batchCoeffBegins[batch];
+        extended.positionEnd = std::min((batch + 1) * batchSize, m_NumPositions);
+        extended.coeffEnd = batchCoeffEnds[batch];
+        if (chunkBytes(extended) > bufferBytes && chunk.positionEnd > chunk.positionBegin)
+        {
+            m_Chunks.push_back(chunk);
+            extended = {chunk.positionEnd, std::min((batch + 1) * batchSize, m_NumPositions),
+                batchCoeffBegins[batch], batchCoeffEnds[batch]};
+        }
+        if (chunkBytes(extended) > bufferBytes)
+        {
+            std::cout << "Error: Memory budget is too small to hold a single batch" << std::endl;
+            exit(1);
+        }
+        chunk = extended;
+    }
+    if (chunk.positionEnd > chunk.positionBegin)
+        m_Chunks.push_back(chunk);
+}
+
+const DatasetStream::ChunkBuffer& DatasetStream::acquire(usize chunkIdx)
+{
+    std::unique_lock lock(m_Mutex);
+    u32 slot = m_Buffers[m_CurrentSlot].chunkIdx == static_cast<i64>(chunkIdx) ? m_CurrentSlot
+        : m_Buffers[m_CurrentSlot ^ 1].chunkIdx == static_cast<i64>(chunkIdx)  ? m_CurrentSlot ^ 1
+                                                                                : 2;
+    if (slot == 2)
+    {
+        // only the first chunk of the first pass isn't prefetched
+        slot = m_CurrentSlot ^ 1;
+        m_CV.wait(lock,
+            [this]()
+            {
+                return m_RequestedSlot < 0;
+            });
+        requestLoad(slot, chunkIdx);
+    }
+
+    if (!m_Buffers[slot].ready)
+    {
+        auto t1 = std::chrono::steady_clock::now();
+        m_CV.wait(lock,
+            [this, slot]()
+            {
+                return m_Buffers[slot].ready;
+            });
+        auto t2 = std::chrono::steady_clock::now();
+        m_StallSeconds += std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+    }
+    // reported here, the loader thread can't exit while the tuner uses the other buffer
+    if (m_Buffers[slot].failed)
+    {
+        std::cout << "Error: Failed reading dataset cache: " << m_Filepath << std::endl;
+        exit(1);
+    }
+    m_CurrentSlot = slot;
+    return m_Buffers[slot];
+}
+
+void DatasetStream::prefetch(usize chunkIdx)
+{
+    std::unique_lock lock(m_Mutex);
+    u32 slot = m_CurrentSlot ^ 1;
+    if (m_Buffers[slot].chunkIdx == static_cast<i64>(chunkIdx))
+        return;
+    m_CV.wait(lock,
+        [this]()
+        {
+            return m_RequestedSlot < 0;
+        });
+    requestLoad(slot, chunkIdx);
+}
+
+void DatasetStream::requestLoad(u32 slot, usize chunkIdx)
+{
+    m_Buffers[slot].chunkIdx = static_cast<i64>(chunkIdx);
+    m_Buffers[slot].ready = false;
+    m_RequestedSlot = static_cast<i32>(slot);
+    m_CV.notify_all();
+}
+
+bool DatasetStream::readChunk(const Chunk& chunk, ChunkBuffer& buffer)
+{
+    usize numPositions = chunk.positionEnd - chunk.positionBegin;
+    usize numCoefficients = chunk.coeffEnd - chunk.coeffBegin;
+    buffer.positions.resize(numPositions);
+    buffer.coefficients.resize(numCoefficients);
+
+    m_File.seekg(positionOffset(chunk.positionBegin));
+    m_File.read(reinterpret_cast<char*>(buffer.positions.data()), numPositions * sizeof(Position));
+    for (auto& pos : buffer.positions)
+        pos.coeffBegin -= chunk.coeffBegin;
+
+    m_File.seekg(positionOffset(m_NumPositions) + chunk.coeffBegin * sizeof(Coefficient));
+    m_File.read(reinterpret_cast<char*>(buffer.coefficients.data()),
+        numCoefficients * sizeof(Coefficient));
+    if (m_HasWeights)
+    {
+        buffer.weights.resize(numPositions);
+        m_File.seekg(weightOffset(chunk.positionBegin));
+        m_File.read(reinterpret_cast<char*>(buffer.weights.data()), numPositions * sizeof(float));
+    }
+    if (!m_File)
+        return false;
+    m_BytesRead += numPositions * sizeof(Position) + numCoefficients * sizeof(Coefficient)
+        + buffer.weights.size() * sizeof(float);
+    return true;
+}
+
+void DatasetStream::loaderLoop()
+{
+    while (true)
+    {
+        std::unique_lock lock(m_Mutex);
+        m_CV.wait(lock,
+            [this]()
+            {
+                return m_ShouldStop || m_RequestedSlot >= 0;
+            });
+        if (m_ShouldStop)
+            return;
+
+        ChunkBuffer& buffer = m_Buffers[m_RequestedSlot];
+        const Chunk& chunk = m_Chunks[buffer.chunkIdx];
+        lock.unlock();
+
+        bool ok = readChunk(chunk, buffer);
+
+        lock.lock();
+        buffer.failed = !ok;
+        buffer.ready = true;
+        m_RequestedSlot = -1;
+        m_CV.notify_all();
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "dataset.h"
+#include "tune.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// reads a dataset cache in chunks instead of loading all of it, for datasets that don't fit
+// in memory. two chunk buffers are used, the next chunk is read on a background thread
+// while the current one is being worked on
+class DatasetStream
+{
+public:
+    // every chunk holds whole batches and fits in half of memoryBudget bytes
+    DatasetStream(const std::string& filepath, usize batchSize, usize memoryBudget);
+    ~DatasetStream();
+
+    DatasetStream(const DatasetStream&) = delete;
+    DatasetStream& operator=(const DatasetStream&) = delete;
+
+    usize size() const
+    {
+        return m_NumPositions;
+    }
+
+    usize numChunks() const
+    {
+        return m_Chunks.size();
+    }
+
+    // the number of positions before deduplication
+    double totalWeight() const
+    {
+        return m_TotalWeight;
+    }
+
+    bool hasWeights() const
+    {
+        return m_HasWeights;
+    }
+
+    // calls fn(positions, weights, coefficients) for every chunk in order, coeffBegin of the
+    // positions is relative to the chunk's coefficients
+    template<typename Fn>
+    void forEachChunk(Fn&& fn)
+    {
+        for (usize i = 0; i < m_Chunks.size(); i++)
+        {
+            const ChunkBuffer& buffer = acquire(i);
+            // wraps around, the next pass almost always follows
+            if (m_Chunks.size() > 1)
+                prefetch((i + 1) % m_Chunks.size());
+            fn(std::span<const Position>(buffer.positions), std::span<const float>(buffer.weights),
+                Coeffs(buffer.coefficients));
+        }
+    }
+
+    // time spent waiting for chunks that hadn't been read yet
+    double stallSeconds() const
+    {
+        return m_StallSeconds;
+    }
+
+    u64 bytesRead() const
+    {
+        return m_BytesRead;
+    }
+
+private:
+    struct Chunk
+    {
+        usize positionBegin;
+        usize positionEnd;
+        usize coeffBegin;
+        usize coeffEnd;
+    };
+
+    struct ChunkBuffer
+    {
+        std::vector<Position, AlignedAllocator<Position>> positions;
+        std::vector<Coefficient, AlignedAllocator<Coefficient>> coefficients;
+        std::vector<float, AlignedAllocator<float>> weights;
+        // chunk that is loaded or being loaded, or -1
+        i64 chunkIdx = -1;
+        bool ready = false;
+        // set with ready if reading the chunk failed
+        bool failed = false;
+    };
+
+    usize weightOffset(usize idx) const;
+    void planChunks(usize batchSize, usize bufferBytes);
+    const ChunkBuffer& acquire(usize chunkIdx);
+    void prefetch(usize chunkIdx);
+    // m_Mutex must be held
+    void requestLoad(u32 slot, usize chunkIdx);
+    // false if the file couldn't be read
+    bool readChunk(const Chunk& chunk, ChunkBuffer& buffer);
+    void loaderLoop();
+
+    std::string m_Filepath;
+    std::ifstream m_File;
+    usize m_NumPositions = 0;
+    usize m_NumCoefficients = 0;
+    bool m_HasWeights = false;
+    double m_TotalWeight = 0;
+    std::vector<Chunk> m_Chunks;
+
+    ChunkBuffer m_Buffers[2];
+    u32 m_CurrentSlot = 0;
+    // slot the loader should fill next, or -1
+    i32 m_RequestedSlot = -1;
+    bool m_ShouldStop = false;
+    std::mutex m_Mutex;
+    std::condition_variable m_CV;
+    std::thread m_Loader;
+
+    double m_StallSeconds = 0;
+    std::atomic_uint64_t m_BytesRead = 0;
+};
@@ -813,12 +813,21 @@ EvalFn::EvalFn(std::vector<Coefficient>& coefficients)
 void EvalFn::reset()
 {
     m_TraceIdx = 0;
+    m_Normal.clear();
+    m_Safety[WHITE].clear();
+    m_Safety[BLACK].clear();
+    m_Complexity.clear();
 }
 
-std::tuple<size_t, size_t, double> EvalFn::getCoefficients(const Board& board)
+u8 EvalFn::appendSegment(const std::vector<Coefficient>& segment)
+{
+    m_Coefficients.insert(m_Coefficients.end(), segment.begin(), segment.end());
+    return static_cast<u8>(segment.size());
+}
+
+bool EvalFn::getCoefficients(const Board& board, Position& pos)
 {
     reset();
-    size_t pos = m_Coefficients.size();
     Trace trace = getTrace(board);
     addCoefficientArray2D(trace.psqt, ParamType::NORMAL);
 
@@ -885,7 +894,18 @@ std::tuple<size_t, size_t, double> EvalFn::getCoefficients(const Board& board)
     addCoefficient(trace.complexityPawnEndgame, ParamType::COMPLEXITY);
     addCoefficient(trace.complexityOffset, ParamType::COMPLEXITY);
 
-    return {pos, m_Coefficients.size(), trace.egScale};
+    // a position stores the size of each segment in a u8
+    for (const auto* segment : {&m_Normal, &m_Safety[WHITE], &m_Safety[BLACK], &m_Complexity})
+        if (segment->size() > UINT8_MAX)
+            return false;
+
+    pos.coeffBegin = m_Coefficients.size();
+    pos.normalCount = appendSegment(m_Normal);
+    pos.safetyCount[WHITE] = appendSegment(m_Safety[WHITE]);
+    pos.safetyCount[BLACK] = appendSegment(m_Safety[BLACK]);
+    pos.complexityCount = appendSegment(m_Complexity);
+    pos.egScaleFactor = static_cast<u8>(std::lround(trace.egScale * EG_SCALE_DENOMINATOR));
+    return true;
 }
 
 template<typename T>
@@ -1023,6 +1043,29 @@ EvalParams EvalFn::getKParams()
     return params;
 }
 
+// changes whenever the trace or the parameter layout changes,
+// so stale dataset caches can be detected. the params are printed with their index and type
+// in place of their values, so renaming, reshaping or reordering terms changes it too
+u64 EvalFn::traceLayoutHash()
+{
+    EvalParams params = getInitialParams();
+    for (usize i = 0; i < params.totalSize(); i++)
+    {
+        params[i].mg = static_cast<double>(i);
+        params[i].eg = static_cast<double>(params[i].type);
+    }
+    std::ostringstream layout;
+    printEvalParams(params, layout);
+
+    u64 hash = murmurHash3(sizeof(Trace));
+    hash = murmurHash3(hash ^ sizeof(Coefficient));
+    hash = murmurHash3(hash ^ sizeof(Position));
+    hash = murmurHash3(hash ^ params.totalSize());
+    for (char c : layout.str())
+        hash = murmurHash3(hash ^ static_cast<u8>(c));
+    return hash;
+}
+
 struct PrintState
 {
     const EvalParams& params;
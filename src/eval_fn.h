@@ -11,10 +11,12 @@ public:
     EvalFn(std::vector<Coefficient>& coefficients);
 
     void reset();
-    std::tuple<size_t, size_t, double> getCoefficients(const Board& board);
+    // false if the position has too many coefficients of one kind, nothing is added then
+    bool getCoefficients(const Board& board, Position& pos);
     static EvalParams getInitialParams();
     static EvalParams getMaterialParams();
     static EvalParams getKParams();
+    static u64 traceLayoutHash();
     static void printEvalParams(const EvalParams& params, std::ostream& os);
     static void printEvalParamsExtracted(const EvalParams& params, std::ostream& os);
 
@@ -22,12 +24,18 @@ private:
     template<typename T>
     void addCoefficient(const T& trace, ParamType type)
     {
-        if ((type == ParamType::NORMAL && trace[0] - trace[1] != 0)
-            || (type == ParamType::COMPLEXITY && trace[0] != 0)
-            || (type == ParamType::SAFETY && (trace[0] != 0 || trace[1] != 0)))
-            m_Coefficients.push_back({static_cast<i16>(m_TraceIdx), static_cast<i16>(trace[0]),
-                static_cast<i16>(trace[1])});
-        m_TraceIdx++;
+        i16 index = static_cast<i16>(m_TraceIdx++);
+        if (type == ParamType::NORMAL && trace[0] - trace[1] != 0)
+            m_Normal.push_back({index, static_cast<i16>(trace[0] - trace[1])});
+        else if (type == ParamType::COMPLEXITY && trace[0] != 0)
+            m_Complexity.push_back({index, static_cast<i16>(trace[0])});
+        else if (type == ParamType::SAFETY)
+        {
+            if (trace[0] != 0)
+                m_Safety[Color::WHITE].push_back({index, static_cast<i16>(trace[0])});
+            if (trace[1] != 0)
+                m_Safety[Color::BLACK].push_back({index, static_cast<i16>(trace[1])});
+        }
     }
 
     template<typename T>
@@ -51,6 +59,11 @@ private:
             addCoefficientArray2D(traceElem, type);
     }
 
+    u8 appendSegment(const std::vector<Coefficient>& segment);
+
     std::vector<Coefficient>& m_Coefficients;
+    std::vector<Coefficient> m_Normal;
+    ColorArray<std::vector<Coefficient>> m_Safety;
+    std::vector<Coefficient> m_Complexity;
     i32 m_TraceIdx;
 };
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "thread_pool.h"
+#include "tune.h"
+
+#include <algorithm>
+#include <span>
+#include <vector>
+
+// per thread gradient buffers that are kept for the whole tuning run
+// every thread's buffer starts on its own cache line, and the buffers are zeroed
+// while being reduced, so they are ready for the next batch without a separate pass
+template<typename Real>
+class GradientArena
+{
+public:
+    GradientArena(u32 threads, usize size)
+        : m_Threads(threads), m_Size(size), m_Stride(roundToLine(size)), m_Scratch(threads)
+    {
+        m_Data.resize(m_Stride * threads, {0, 0});
+    }
+
+    // params used by the last markTouched() call, sorted
+    const std::vector<u32>& touched() const
+    {
+        return m_Touched;
+    }
+
+    BasicGradient<Real>* thread(u32 threadID)
+    {
+        return m_Data.data() + threadID * m_Stride;
+    }
+
+    // what a thread works on of a batch and the error it sums up, reused by every batch
+    struct alignas(CACHE_LINE_SIZE) ThreadScratch
+    {
+        std::vector<PositionBlock> parts;
+        double error = 0.0;
+    };
+
+    ThreadScratch& scratch(u32 threadID)
+    {
+        return m_Scratch[threadID];
+    }
+
+    // gradients[i] = scale * sum of every thread's gradient i
+    // each worker reduces its own slice of the param range, so every buffer is read once
+    // in total and the work is split evenly however many threads there are
+    void reduce(ThreadPool& threadPool, std::span<Gradient> gradients, double scale)
+    {
+        u32 slices = threadPool.concurrency();
+        threadPool.run(
+            [&](u32 slice)
+            {
+                // slices start on a cache line so no two workers write the same one
+                usize begin = std::min(m_Size, roundToLine(m_Size * slice / slices));
+                usize end = std::min(m_Size, roundToLine(m_Size * (slice + 1) / slices));
+                for (usize i = begin; i < end; i++)
+                    reduceParam(i, gradients, scale);
+            });
+    }
+
+    // sparse mode: finds the params any of the positions in the blocks of a batch use
+    template<typename Position>
+    void markTouched(ThreadPool& threadPool, std::span<const Position> positions,
+        std::span<const PositionBlock> blocks, usize numPositions, Coeffs coefficients)
+    {
+        if (m_ThreadTouched.empty())
+        {
+            m_ThreadTouched.resize(m_Threads);
+            m_FlagStride = (m_Size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+            m_ThreadFlags.resize(m_FlagStride * m_Threads, false);
+            m_Flags.resize(m_Size, false);
+        }
+        for (u32 idx : m_Touched)
+            m_Flags[idx] = false;
+        m_Touched.clear();
+
+        threadPool.run(
+            [&](u32 threadID)
+            {
+                u8* flags = m_ThreadFlags.data() + threadID * m_FlagStride;
+                std::vector<u32>& touched = m_ThreadTouched[threadID];
+                forEachBlockSlice(threadID, threadPool.concurrency(), blocks, numPositions,
+                    [&](usize beginIdx, usize endIdx)
+                    {
+                        for (usize i = beginIdx; i < endIdx; i++)
+                        {
+                            const Position& pos = positions[i];
+                            for (const Coefficient& coeff :
+                                coefficients.subspan(pos.coeffBegin, pos.coeffCount()))
+                            {
+                                if (flags[coeff.index])
+                                    continue;
+                                flags[coeff.index] = true;
+                                touched.push_back(coeff.index);
+                            }
+                        }
+                    });
+            });
+
+        for (u32 threadID = 0; threadID < m_Threads; threadID++)
+        {
+            u8* flags = m_ThreadFlags.data() + threadID * m_FlagStride;
+            for (u32 idx : m_ThreadTouched[threadID])
+            {
+                flags[idx] = false;
+                if (m_Flags[idx])
+                    continue;
+                m_Flags[idx] = true;
+                m_Touched.push_back(idx);
+            }
+            m_ThreadTouched[threadID].clear();
+        }
+        std::sort(m_Touched.begin(), m_Touched.end());
+    }
+
+    // reduce() restricted to the params from the last markTouched() call
+    // the gradients of all other params are left unchanged
+    void reduceTouched(ThreadPool& threadPool, std::span<Gradient> gradients, double scale)
+    {
+        threadPool.parallelFor(0, m_Touched.size(),
+            [&](u32, usize begin, usize end)
+            {
+                for (usize j = begin; j < end; j++)
+                    reduceParam(m_Touched[j], gradients, scale);
+            });
+    }
+
+private:
+    static constexpr usize PER_LINE = CACHE_LINE_SIZE / sizeof(BasicGradient<Real>);
+
+    static usize roundToLine(usize count)
+    {
+        return (count + PER_LINE - 1) / PER_LINE * PER_LINE;
+    }
+
+    // pairwise sum of param i over the buffers of threads [begin, end), zeroing them.
+    // the rounding error grows with log2 of the thread count instead of linearly
+    Gradient sumThreads(usize i, u32 begin, u32 end)
+    {
+        if (end - begin == 1)
+        {
+            BasicGradient<Real>& threadGrad = m_Data[begin * m_Stride + i];
+            Gradient grad = {threadGrad.mg, threadGrad.eg};
+            threadGrad = {0, 0};
+            return grad;
+        }
+        u32 mid = begin + (end - begin) / 2;
+        Gradient lhs = sumThreads(i, begin, mid);
+        Gradient rhs = sumThreads(i, mid, end);
+        return {lhs.mg + rhs.mg, lhs.eg + rhs.eg};
+    }
+
+    void reduceParam(usize i, std::span<Gradient> gradients, double scale)
+    {
+        Gradient grad = sumThreads(i, 0, m_Threads);
+        gradients[i] = {grad.mg * scale, grad.eg * scale};
+    }
+
+    u32 m_Threads;
+    usize m_Size;
+    usize m_Stride;
+    std::vector<BasicGradient<Real>, AlignedAllocator<BasicGradient<Real>>> m_Data;
+    std::vector<ThreadScratch> m_Scratch;
+
+    // sparse mode only
+    std::vector<std::vector<u32>> m_ThreadTouched;
+    usize m_FlagStride = 0;
+    std::vector<u8, AlignedAllocator<u8>> m_ThreadFlags;
+    std::vector<u8> m_Flags;
+    std::vector<u32> m_Touched;
+};
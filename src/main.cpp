@@ -1,36 +1,109 @@
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "bench.h"
 #include "eval_fn.h"
 #include "sirius/attacks.h"
 #include "sirius/zobrist.h"
+#include "thread_pool.h"
 #include "tune.h"
+#include "tune_config.h"
 
 
-int main()
+int main(int argc, char** argv)
 {
     attacks::init();
 
-    std::string mode;
-    std::cin >> mode;
+    TuneConfig config;
+    std::vector<std::string> args;
+    if (argc > 1)
+        args = parseCommandLine(config, argc, argv);
+    else
+    {
+        // no arguments, read the mode and its paths from stdin like before
+        std::string mode;
+        std::cin >> mode;
+        args.push_back(mode);
+        if (mode == "tune" || mode == "extract")
+        {
+            std::string first, second;
+            std::cin >> first >> second;
+            args.push_back(first);
+            args.push_back(second);
+        }
+    }
+
+    std::string mode = args.empty() ? "" : args[0];
+    if ((mode == "tune" || mode == "extract") && args.size() != 3)
+    {
+        std::cout << "Error: Usage: " << mode << " <dataset> "
+                  << (mode == "tune" ? "<output>" : "<cache>") << " [--option=value ...]"
+                  << std::endl;
+        exit(1);
+    }
 
     if (mode == "tune")
     {
-        std::string datasetFilepath;
-        std::string outFilepath;
-        std::cin >> datasetFilepath >> outFilepath;
+        std::string datasetFilepath = args[1];
+        std::string outFilepath = args[2];
 
-        std::ifstream datasetFile(datasetFilepath);
         std::ofstream outFile(outFilepath);
 
-        Dataset data = loadDataset(datasetFile);
+        printConfig(config, std::cout);
+        printConfig(config, outFile);
+        if (isDatasetCache(datasetFilepath))
+            rejectLoadOptions(config);
+        ThreadPool threadPool(resolveThreads(config), config.pinThreads);
+        if (config.memoryBudgetMB > 0)
+        {
+            if (!isDatasetCache(datasetFilepath))
+            {
+                std::cout << "Error: Streaming needs a dataset cache, run extract first"
+                          << std::endl;
+                exit(1);
+            }
+            EvalParams params = tuneStreamed(threadPool, config, datasetFilepath, outFile);
+            EvalFn::printEvalParamsExtracted(params, std::cout);
+            EvalFn::printEvalParamsExtracted(params, outFile);
+            return 0;
+        }
+        Dataset data = isDatasetCache(datasetFilepath)
+            ? loadDatasetCache(datasetFilepath)
+            : loadDataset(threadPool, datasetFilepath, datasetLoadOptions(config));
+        if (config.pinThreads)
+            placeDataset(threadPool, config, data);
 
-        EvalParams params = tune(data, outFile);
+        EvalParams params = tune(threadPool, config, data, outFile);
         EvalFn::printEvalParamsExtracted(params, std::cout);
         EvalFn::printEvalParamsExtracted(params, outFile);
     }
+    else if (mode == "extract")
+    {
+        std::string datasetFilepath = args[1];
+        std::string cacheFilepath = args[2];
+
+        ThreadPool threadPool(resolveThreads(config));
+        Dataset data = loadDataset(threadPool, datasetFilepath, datasetLoadOptions(config));
+        saveDatasetCache(data, cacheFilepath);
+        std::cout << "Wrote " << data.positions.size() << " positions to " << cacheFilepath
+                  << std::endl;
+    }
+    else if (mode == "bench")
+    {
+        runKernelBench();
+        runThreadPoolBench(resolveThreads(config));
+        runReduceBench(resolveThreads(config));
+        runFenBench();
+        runParseBench();
+    }
     else if (mode == "params")
     {
         EvalFn::printEvalParamsExtracted(EvalFn::getInitialParams(), std::cout);
     }
+    else
+    {
+        std::cout << "Error: Unknown mode: " << mode << std::endl;
+        exit(1);
+    }
 }
@@ -0,0 +1,118 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filepath)
+{
+    HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    m_FileHandle = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        close();
+        return;
+    }
+    // a mapping can't be created for an empty file
+    if (size.QuadPart == 0)
+    {
+        close();
+        m_Open = true;
+        return;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        close();
+        return;
+    }
+    m_MappingHandle = mapping;
+
+    m_Data = static_cast<const u8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_Data == nullptr)
+    {
+        close();
+        return;
+    }
+    m_Size = static_cast<usize>(size.QuadPart);
+    m_Open = true;
+}
+
+void MappedFile::close()
+{
+    if (m_Data)
+        UnmapViewOfFile(m_Data);
+    if (m_MappingHandle)
+        CloseHandle(m_MappingHandle);
+    if (m_FileHandle)
+        CloseHandle(m_FileHandle);
+    m_Data = nullptr;
+    m_MappingHandle = nullptr;
+    m_FileHandle = nullptr;
+    m_Size = 0;
+    m_Open = false;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filepath)
+{
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return;
+    }
+    // mmap fails for an empty file
+    if (st.st_size == 0)
+    {
+        ::close(fd);
+        m_Open = true;
+        return;
+    }
+
+    void* data = mmap(nullptr, static_cast<usize>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return;
+
+    madvise(data, static_cast<usize>(st.st_size), MADV_SEQUENTIAL);
+    m_Data = static_cast<const u8*>(data);
+    m_Size = static_cast<usize>(st.st_size);
+    m_Open = true;
+}
+
+void MappedFile::close()
+{
+    if (m_Data)
+        munmap(const_cast<u8*>(m_Data), m_Size);
+    m_Data = nullptr;
+    m_Size = 0;
+    m_Open = false;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "sirius/defs.h"
+
+#include <string>
+
+// read only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const std::string& filepath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // also true for an empty file, which has no mapping
+    bool isOpen() const
+    {
+        return m_Open;
+    }
+
+    const u8* data() const
+    {
+        return m_Data;
+    }
+
+    usize size() const
+    {
+        return m_Size;
+    }
+
+private:
+    void close();
+
+    bool m_Open = false;
+    const u8* m_Data = nullptr;
+    usize m_Size = 0;
+#ifdef _WIN32
+    void* m_FileHandle = nullptr;
+    void* m_MappingHandle = nullptr;
+#endif
+};
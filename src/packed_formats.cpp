@@ -0,0 +1,162 @@
+#include "packed_formats.h"
+#include "sirius/board.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace
+{
+
+template<typename T>
+T readField(const u8* record, usize offset)
+{
+    T value;
+    std::memcpy(&value, record + offset, sizeof(T));
+    return value;
+}
+
+constexpr u8 UNMOVED_ROOK = 6;
+constexpr u8 NO_EP_SQUARE = 64;
+
+// nibble i belongs to the i'th set bit of occupancy, from the least significant bit
+u8 pieceNibble(const u8* record, i32 index)
+{
+    return (record[8 + index / 2] >> (4 * (index & 1))) & 0xF;
+}
+
+}
+
+bool decodeMarlinformat(
+    const u8* record, Board& board, i32& score, double& wdl, bool validate)
+{
+    u64 occupancy = readField<u64>(record, 0);
+    u8 stmEp = readField<u8>(record, 24);
+    i16 eval = readField<i16>(record, 28);
+    u8 result = readField<u8>(record, 30);
+    if (validate && (std::popcount(occupancy) > 32 || result > 2))
+        return false;
+
+    std::array<Piece, 64> squares;
+    squares.fill(Piece::NONE);
+    u64 unmovedRooks = 0;
+    ColorArray<i32> kingFiles = {-1, -1};
+    for (i32 i = 0; occupancy && i < 32; i++, occupancy &= occupancy - 1)
+    {
+        i32 sq = std::countr_zero(occupancy);
+        u8 nibble = pieceNibble(record, i);
+        Color color = nibble & 8 ? Color::BLACK : Color::WHITE;
+        PieceType type = static_cast<PieceType>(nibble & 7);
+        if ((nibble & 7) == UNMOVED_ROOK)
+        {
+            type = PieceType::ROOK;
+            unmovedRooks |= 1ull << sq;
+        }
+        else if (type == PieceType::KING)
+            kingFiles[color] = sq & 7;
+        squares[sq] = makePiece(type, color);
+    }
+
+    CastlingRights castlingRights = CastlingRights::NONE;
+    for (; unmovedRooks; unmovedRooks &= unmovedRooks - 1)
+    {
+        i32 sq = std::countr_zero(unmovedRooks);
+        Color color = getPieceColor(squares[sq]);
+        if (kingFiles[color] < 0)
+            continue;
+        CastleSide side = (sq & 7) > kingFiles[color] ? CastleSide::KING_SIDE
+                                                      : CastleSide::QUEEN_SIDE;
+        castlingRights |= CastlingRights(color, side);
+    }
+
+    Color stm = stmEp & 0x80 ? Color::BLACK : Color::WHITE;
+    i32 epSquare = (stmEp & 0x7F) == NO_EP_SQUARE ? -1 : stmEp & 0x7F;
+    i32 fullMove = readField<u16>(record, 26);
+    i32 gamePly = fullMove > 0 ? 2 * fullMove - 1 - (stm == Color::WHITE) : 0;
+    if (!board.loadPosition(squares, stm, castlingRights, epSquare, readField<u8>(record, 25),
+            gamePly, validate))
+        return false;
+
+    score = eval;
+    wdl = result / 2.0;
+    return true;
+}
+
+void encodeMarlinformat(const Board& board, i32 score, double wdl, u8* record)
+{
+    std::memset(record, 0, PACKED_RECORD_SIZE);
+
+    // the rook each castling right belongs to is the outermost one on that side of the king
+    Bitboard unmovedRooks = EMPTY_BB;
+    for (Color color : {Color::WHITE, Color::BLACK})
+    {
+        Bitboard backRank = color == Color::WHITE ? RANK_1_BB : RANK_8_BB;
+        Bitboard rooks = board.pieces(color, PieceType::ROOK) & backRank;
+        i32 kingFile = board.kingSq(color).file();
+        Bitboard kingSide = EMPTY_BB, queenSide = EMPTY_BB;
+        for (Bitboard it = rooks; it.any();)
+        {
+            Square sq = it.poplsb();
+            (sq.file() > kingFile ? kingSide : queenSide) |= Bitboard::fromSquare(sq);
+        }
+        if (board.castlingRights().has(CastlingRights(color, CastleSide::KING_SIDE))
+            && kingSide.any())
+            unmovedRooks |= Bitboard::fromSquare(kingSide.msb());
+        if (board.castlingRights().has(CastlingRights(color, CastleSide::QUEEN_SIDE))
+            && queenSide.any())
+            unmovedRooks |= Bitboard::fromSquare(queenSide.lsb());
+    }
+
+    u64 occupancy = board.allPieces().value();
+    std::memcpy(record, &occupancy, sizeof(occupancy));
+    i32 i = 0;
+    for (Bitboard it = board.allPieces(); it.any(); i++)
+    {
+        Square sq = it.poplsb();
+        Piece piece = board.pieceAt(sq);
+        u8 nibble = (unmovedRooks & Bitboard::fromSquare(sq)).any()
+            ? static_cast<u8>(UNMOVED_ROOK | (static_cast<i32>(getPieceColor(piece)) << 3))
+            : static_cast<u8>(piece);
+        record[8 + i / 2] |= nibble << (4 * (i & 1));
+    }
+
+    i32 epSquare = board.epSquare() >= 0 ? board.epSquare() : NO_EP_SQUARE;
+    record[24] = static_cast<u8>(epSquare | (board.sideToMove() == Color::BLACK ? 0x80 : 0));
+    record[25] = static_cast<u8>(std::min(board.halfMoveClock(), 255));
+    u16 fullMove = static_cast<u16>(board.gamePly() / 2 + 1);
+    std::memcpy(record + 26, &fullMove, sizeof(fullMove));
+    i16 eval = static_cast<i16>(std::clamp<i32>(score, INT16_MIN, INT16_MAX));
+    std::memcpy(record + 28, &eval, sizeof(eval));
+    record[30] = static_cast<u8>(wdl * 2);
+}
+
+bool decodeBulletformat(
+    const u8* record, Board& board, i32& score, double& wdl, bool validate)
+{
+    u64 occupancy = readField<u64>(record, 0);
+    i16 eval = readField<i16>(record, 24);
+    u8 result = readField<u8>(record, 26);
+    if (validate && (std::popcount(occupancy) > 32 || result > 2))
+        return false;
+
+    // the king squares are redundant with the pieces and not needed
+    std::array<Piece, 64> squares;
+    squares.fill(Piece::NONE);
+    for (i32 i = 0; occupancy && i < 32; i++, occupancy &= occupancy - 1)
+    {
+        u8 nibble = pieceNibble(record, i);
+        // piece types only go up to the king, 6 and 7 would load as no piece or out of range
+        if (validate && (nibble & 7) > static_cast<i32>(PieceType::KING))
+            return false;
+        // the side to move has color bit 0, so it loads as white
+        squares[std::countr_zero(occupancy)] = static_cast<Piece>(nibble);
+    }
+
+    // there are no move counters either
+    if (!board.loadPosition(squares, Color::WHITE, CastlingRights::NONE, -1, 0, 0, validate))
+        return false;
+
+    score = eval;
+    wdl = result / 2.0;
+    return true;
+}
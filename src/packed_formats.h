@@ -0,0 +1,24 @@
+#pragma once
+
+#include "sirius/defs.h"
+
+class Board;
+
+// 32 byte training data records written by other engines' data generators
+// all of them decode straight into a board without going through a fen
+constexpr usize PACKED_RECORD_SIZE = 32;
+
+// marlinformat PackedBoard: occupancy, a nibble per occupied square (unmoved rooks carry
+// castling rights), stm and ep square, halfmove clock, fullmove number, white relative
+// score, white relative wdl and an unused byte
+bool decodeMarlinformat(
+    const u8* record, Board& board, i32& score, double& wdl, bool validate);
+
+// writes the board with a white relative score and wdl as a marlinformat record
+void encodeMarlinformat(const Board& board, i32 score, double wdl, u8* record);
+
+// bulletformat ChessBoard: occupancy, a nibble per occupied square, score, wdl, both king
+// squares and 3 unused bytes. everything is relative to the side to move, with the board
+// flipped when black is to move, so positions load as white to move
+bool decodeBulletformat(
+    const u8* record, Board& board, i32& score, double& wdl, bool validate);
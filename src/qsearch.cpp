@@ -0,0 +1,111 @@
+#include "qsearch.h"
+#include "sirius/board.h"
+#include "sirius/movegen.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// same values the engine uses for see
+constexpr std::array<i32, 7> PIECE_VALUES = {100, 450, 450, 675, 1300, 0, 0};
+constexpr i32 SCORE_INF = 32000;
+
+// triangular pv table, line[ply] holds the best line found from ply
+struct PvTable
+{
+    std::array<std::array<Move, MAX_RESOLVE_PLY>, MAX_RESOLVE_PLY + 1> line;
+    std::array<i32, MAX_RESOLVE_PLY + 1> length;
+};
+
+i32 pieceValue(Piece piece)
+{
+    return PIECE_VALUES[static_cast<i32>(getPieceType(piece))];
+}
+
+// material balance from the side to move's point of view
+i32 materialEval(const Board& board)
+{
+    i32 eval = 0;
+    for (i32 type = 0; type < 5; type++)
+    {
+        PieceType pieceType = static_cast<PieceType>(type);
+        eval += PIECE_VALUES[type]
+            * (static_cast<i32>(board.pieces(Color::WHITE, pieceType).popcount())
+                - static_cast<i32>(board.pieces(Color::BLACK, pieceType).popcount()));
+    }
+    return board.sideToMove() == Color::WHITE ? eval : -eval;
+}
+
+// most valuable victim, least valuable attacker
+i32 moveOrder(const Board& board, Move move)
+{
+    i32 victim = move.type() == MoveType::ENPASSANT ? PIECE_VALUES[0]
+                                                     : pieceValue(board.pieceAt(move.toSq()));
+    if (move.type() == MoveType::PROMOTION)
+        victim += PIECE_VALUES[static_cast<i32>(promoPiece(move.promotion()))];
+    return victim * 8 - pieceValue(board.pieceAt(move.fromSq())) / 100;
+}
+
+i32 qsearch(Board& board, i32 alpha, i32 beta, i32 ply, i32 maxPly, PvTable& pv)
+{
+    pv.length[ply] = 0;
+
+    i32 standPat = materialEval(board);
+    // evasions would need quiet moves, which would no longer make this a capture search
+    if (ply >= maxPly || board.checkers().any() || standPat >= beta)
+        return standPat;
+    alpha = std::max(alpha, standPat);
+
+    MoveList moves;
+    genMoves<MoveGenType::NOISY>(board, moves);
+    std::array<i32, 256> order;
+    for (usize i = 0; i < moves.size(); i++)
+        order[i] = moveOrder(board, moves[i]);
+
+    i32 bestScore = standPat;
+    for (usize i = 0; i < moves.size(); i++)
+    {
+        // selection sort, most positions only have a handful of captures
+        usize best = i;
+        for (usize j = i + 1; j < moves.size(); j++)
+            if (order[j] > order[best])
+                best = j;
+        std::swap(moves[i], moves[best]);
+        std::swap(order[i], order[best]);
+
+        Move move = moves[i];
+        if (!board.isLegal(move) || !board.see(move, 0))
+            continue;
+
+        board.makeMove(move);
+        i32 score = -qsearch(board, -beta, -alpha, ply + 1, maxPly, pv);
+        board.unmakeMove();
+
+        if (score <= bestScore)
+            continue;
+        bestScore = score;
+        if (score > alpha)
+        {
+            alpha = score;
+            pv.line[ply][0] = move;
+            std::copy_n(pv.line[ply + 1].begin(), pv.length[ply + 1], pv.line[ply].begin() + 1);
+            pv.length[ply] = pv.length[ply + 1] + 1;
+        }
+        if (score >= beta)
+            break;
+    }
+    return bestScore;
+}
+
+}
+
+i32 resolveQuiet(Board& board, i32 maxPly)
+{
+    board.initThreats();
+    PvTable pv;
+    qsearch(board, -SCORE_INF, SCORE_INF, 0, std::min(maxPly, MAX_RESOLVE_PLY), pv);
+    for (i32 i = 0; i < pv.length[0]; i++)
+        board.makeMove(pv.line[0][i]);
+    return pv.length[0];
+}
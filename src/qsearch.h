@@ -0,0 +1,14 @@
+#pragma once
+
+#include "sirius/defs.h"
+
+class Board;
+
+// deepest line a resolve can play, the tables of the search are sized for it
+constexpr i32 MAX_RESOLVE_PLY = 32;
+
+// plays the principal variation of a material only quiescence search on board, so it ends
+// on a position without good captures or promotions left for either side. only legal
+// noisy moves that don't lose material by see are searched, and the search stands pat
+// when in check or after maxPly plies. returns the number of moves played
+i32 resolveQuiet(Board& board, i32 maxPly);
@@ -1,6 +1,7 @@
 #pragma once
 
-constexpr i32 TUNE_THREADS = 4;
+// 0 uses one thread per hardware thread
+constexpr i32 TUNE_THREADS = 0;
 constexpr i32 TUNE_MAX_EPOCHS = 900;
 constexpr bool TUNE_FROM_ZERO = false;
 constexpr bool TUNE_FROM_MATERIAL = true;
@@ -8,7 +9,39 @@ constexpr i32 BATCH_SIZE = 16384;
 constexpr double WDL_LAMBDA = 0.75;
 constexpr float TUNE_LR = 0.02;
 constexpr float TUNE_K = 0.0;
+// full dataset l-bfgs instead of minibatch adam, epochs is then the most iterations it runs
+constexpr bool TUNE_LBFGS = false;
+// run the eval/gradient kernels in float, the optimizer and reductions stay in double
+constexpr bool TUNE_SINGLE_PRECISION = false;
+// only update the params each batch uses, skipped adam steps are applied lazily
+constexpr bool TUNE_SPARSE = false;
+// visit the blocks of positions that make up the batches in a new random order every epoch
+constexpr bool TUNE_SHUFFLE = false;
+// pin threads to cpus grouped by numa node, and place the dataset next to the threads using it.
+// with shuffling, each thread's blocks are then only shuffled among themselves, so its
+// positions stay on its node and every batch holds an even share of each thread's blocks
+constexpr bool TUNE_PIN_THREADS = false;
+// stream the dataset cache in chunks using at most this many MiB, 0 loads all of it
+constexpr u32 TUNE_MEMORY_BUDGET_MB = 0;
+// merge repeated positions when loading a text dataset, weighting them by how often they appear
+constexpr bool TUNE_DEDUP = false;
+// check every fen in a text dataset instead of assuming they are valid
+constexpr bool TUNE_VALIDATE_FENS = false;
+// drop positions while loading, before they are traced
+constexpr bool TUNE_SKIP_IN_CHECK = false;
+// positions where the side to move has a capture or promotion that doesn't lose material
+constexpr bool TUNE_SKIP_NOISY = false;
+// drop positions with a larger absolute score, 0 keeps all of them
+constexpr i32 TUNE_MAX_SCORE = 0;
+// drop positions before this game ply
+constexpr i32 TUNE_MIN_PLY = 0;
+// keep a uniform random sample of this many of the loaded positions, 0 keeps all of them
+constexpr u64 TUNE_SAMPLE_SIZE = 0;
+// trace the leaf of a material only quiescence search of at most this many plies instead
+// of each position, 0 traces the positions as they are
+constexpr i32 TUNE_RESOLVE_PLY = 0;
 
-static_assert(TUNE_MAX_EPOCHS % 100 == 0 && TUNE_MAX_EPOCHS > 0,
-    "TUNE_MAX_EPOCHS must be divisible by 100 and greater than 0");
+static_assert(TUNE_MAX_EPOCHS > 0, "TUNE_MAX_EPOCHS must be greater than 0");
+static_assert(TUNE_LBFGS || TUNE_MAX_EPOCHS % 100 == 0,
+    "TUNE_MAX_EPOCHS must be divisible by 100 with the adam optimizer");
 static_assert(!TUNE_FROM_ZERO || !TUNE_FROM_MATERIAL, "Cannot tune from zero and material values");
@@ -179,6 +179,202 @@ done:
     calcThreats();
 }
 
+BoardState& Board::resetForLoad()
+{
+    if (m_States.empty())
+        m_States.emplace_back();
+    m_States.resize(1);
+    BoardState& state = currState();
+    state = BoardState{};
+    state.squares.fill(Piece::NONE);
+    state.epSquare = -1;
+    // standard rook squares, so makeMove drops the rights of moved or captured rooks.
+    // built once, the masks cost more than the rest of the reset
+    static const CastlingData standardCastling = []()
+    {
+        CastlingData data;
+        data.initMasks();
+        return data;
+    }();
+    m_CastlingData = standardCastling;
+    m_FRC = false;
+    m_GamePly = 0;
+    return state;
+}
+
+bool Board::hasOneKingEach() const
+{
+    return pieces(Color::WHITE, PieceType::KING).popcount() == 1
+        && pieces(Color::BLACK, PieceType::KING).popcount() == 1;
+}
+
+bool Board::isLoadedPositionValid() const
+{
+    if ((pieces(PieceType::PAWN) & (RANK_1_BB | RANK_8_BB)).any())
+        return false;
+    // the side that just moved can't be left in check
+    return !attackersTo(m_SideToMove, kingSq(~m_SideToMove)).any();
+}
+
+bool Board::loadFen(std::string_view fen, bool validate)
+{
+    BoardState& state = resetForLoad();
+
+    usize i = 0;
+    i32 rank = 7, file = 0;
+    for (; i < fen.size() && fen[i] != ' '; i++)
+    {
+        char c = fen[i];
+        // the shape of the board is always checked, a bad line must not write out of bounds
+        if (c == '/')
+        {
+            if (file != 8 || rank == 0)
+                return false;
+            rank--;
+            file = 0;
+            continue;
+        }
+        if (c >= '1' && c <= '8')
+        {
+            file += c - '0';
+            if (file > 8)
+                return false;
+            continue;
+        }
+
+        // same order as PieceType
+        constexpr std::string_view PIECE_CHARS = "pnbrqk";
+        usize type = PIECE_CHARS.find(static_cast<char>(c | 0x20));
+        if (type == std::string_view::npos || file >= 8)
+            return false;
+        Color color = c & 0x20 ? Color::BLACK : Color::WHITE;
+        PieceType pieceType = static_cast<PieceType>(type);
+        Square sq(rank, file++);
+        state.squares[sq.value()] = makePiece(pieceType, color);
+        Bitboard sqBB = Bitboard::fromSquare(sq);
+        state.pieces[type] |= sqBB;
+        state.colors[static_cast<i32>(color)] |= sqBB;
+        state.zkey.addPiece(pieceType, color, sq);
+    }
+    // castling and the check info need the kings
+    if (rank != 0 || file != 8 || !hasOneKingEach())
+        return false;
+
+    // fields after the pieces, each may be missing
+    auto nextField = [&]()
+    {
+        while (i < fen.size() && fen[i] == ' ')
+            i++;
+        usize begin = i;
+        while (i < fen.size() && fen[i] != ' ')
+            i++;
+        return fen.substr(begin, i - begin);
+    };
+
+    std::string_view stm = nextField();
+    if (validate && stm != "w" && stm != "b")
+        return false;
+    m_SideToMove = stm == "b" ? Color::BLACK : Color::WHITE;
+    if (m_SideToMove == Color::BLACK)
+        state.zkey.flipSideToMove();
+
+    state.castlingRights = CastlingRights::NONE;
+    for (char c : nextField())
+    {
+        if (c == '-')
+            break;
+        Color color = std::isupper(c) ? Color::WHITE : Color::BLACK;
+        c = static_cast<char>(std::tolower(c));
+        if (c == 'k')
+            state.castlingRights |= CastlingRights(color, CastleSide::KING_SIDE);
+        else if (c == 'q')
+            state.castlingRights |= CastlingRights(color, CastleSide::QUEEN_SIDE);
+        else if (c >= 'a' && c <= 'h')
+        {
+            CastleSide side =
+                c - 'a' > kingSq(color).file() ? CastleSide::KING_SIDE : CastleSide::QUEEN_SIDE;
+            state.castlingRights |= CastlingRights(color, side);
+        }
+        else if (validate)
+            return false;
+    }
+    state.zkey.updateCastlingRights(state.castlingRights);
+
+    std::string_view epSq = nextField();
+    if (epSq.size() >= 2 && epSq[0] >= 'a' && epSq[0] <= 'h' && epSq[1] >= '1' && epSq[1] <= '8')
+    {
+        state.epSquare = (epSq[0] - 'a') | ((epSq[1] - '1') << 3);
+        state.zkey.updateEP(state.epSquare & 7);
+    }
+    else if (validate && epSq != "-")
+        return false;
+
+    // the move counters are optional
+    std::string_view halfMoveClock = nextField();
+    std::from_chars(halfMoveClock.data(), halfMoveClock.data() + halfMoveClock.size(),
+        state.halfMoveClock);
+    std::string_view fullMoves = nextField();
+    i32 fullMove = 0;
+    std::from_chars(fullMoves.data(), fullMoves.data() + fullMoves.size(), fullMove);
+    if (fullMove > 0)
+        m_GamePly = 2 * fullMove - 1 - (m_SideToMove == Color::WHITE);
+
+    if (validate && !isLoadedPositionValid())
+        return false;
+
+    updateCheckInfo();
+    return true;
+}
+
+bool Board::loadPosition(const std::array<Piece, 64>& squares, Color stm,
+    CastlingRights castlingRights, i32 epSquare, i32 halfMoveClock, i32 gamePly, bool validate)
+{
+    BoardState& state = resetForLoad();
+    state.halfMoveClock = halfMoveClock;
+    m_GamePly = gamePly;
+    for (i32 sq = 0; sq < 64; sq++)
+    {
+        Piece piece = squares[sq];
+        if (piece == Piece::NONE)
+            continue;
+        PieceType pieceType = getPieceType(piece);
+        Color color = getPieceColor(piece);
+        if (pieceType >= PieceType::NONE || static_cast<u8>(piece) >= 16)
+        {
+            if (validate)
+                return false;
+            continue;
+        }
+        state.squares[sq] = piece;
+        Bitboard sqBB = Bitboard::fromSquare(Square(sq));
+        state.pieces[static_cast<i32>(pieceType)] |= sqBB;
+        state.colors[static_cast<i32>(color)] |= sqBB;
+        state.zkey.addPiece(pieceType, color, Square(sq));
+    }
+
+    if (!hasOneKingEach())
+        return false;
+
+    m_SideToMove = stm;
+    if (m_SideToMove == Color::BLACK)
+        state.zkey.flipSideToMove();
+    state.castlingRights = castlingRights;
+    state.zkey.updateCastlingRights(state.castlingRights);
+    if (epSquare >= 0 && epSquare < 64)
+    {
+        state.epSquare = epSquare;
+        state.zkey.updateEP(state.epSquare & 7);
+    }
+    else if (validate && epSquare != -1)
+        return false;
+
+    if (validate && !isLoadedPositionValid())
+        return false;
+
+    updateCheckInfo();
+    return true;
+}
+
 // clang-format off
 constexpr std::array<char, 16> pieceChars = {
     'P', 'N', 'B', 'R', 'Q', 'K', ' ', ' ',
@@ -1050,6 +1246,11 @@ void Board::updateCheckInfo()
         currState().checkInfo.discoverers[static_cast<i32>(Color::BLACK)]);
 }
 
+void Board::initThreats()
+{
+    calcThreats();
+}
+
 void Board::calcThreats()
 {
     Color color = ~m_SideToMove;
@@ -158,6 +158,16 @@ public:
     Board(const BoardState& state, const CastlingData& castlingData, Color stm, i32 gamePly);
 
     void setToFen(const std::string_view& fen, bool frc = false);
+    // fast path for bulk loading positions to evaluate. only sets up the pieces, side to move,
+    // castling rights, ep square, move counters, zobrist key and check info, and reuses the
+    // existing state so it doesn't allocate. always returns false if the pieces aren't 8 ranks
+    // of 8 squares of known pieces with one king each. validate adds the checks that the rest
+    // of the fen is well formed and that the position is legal
+    bool loadFen(std::string_view fen, bool validate);
+    // same as loadFen, from the piece on every square and an ep square of -1 for none
+    bool loadPosition(const std::array<Piece, 64>& squares, Color stm,
+        CastlingRights castlingRights, i32 epSquare, i32 halfMoveClock, i32 gamePly,
+        bool validate);
 
     std::string stringRep() const;
     std::string fenStr() const;
@@ -219,6 +229,9 @@ public:
     bool isPseudoLegal(Move move) const;
     bool isLegal(Move move) const;
     ZKey keyAfter(Move move) const;
+    // loadFen and loadPosition skip the threats, which the legality of king moves and
+    // makeMove depend on
+    void initThreats();
 
 private:
     template<bool updateEval>
@@ -230,6 +243,10 @@ private:
     const BoardState& currState() const;
     BoardState& currState();
 
+    // empty board for loadFen and loadPosition
+    BoardState& resetForLoad();
+    bool hasOneKingEach() const;
+    bool isLoadedPositionValid() const;
     void updateCheckInfo();
     void calcThreats();
     void calcRepetitions();
@@ -1,70 +1,140 @@
 #include "thread_pool.h"
+#include "topology.h"
 
-ThreadPool::ThreadPool(u32 concurrency)
-    : m_ShouldStop(false), m_RunningTasks(0)
+#include <algorithm>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// roughly tens of microseconds, long enough to cover the gap between two batches
+constexpr i32 SPIN_ITERATIONS = 1 << 12;
+
+void spinPause()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// waits until value is no longer old, spinning first and then sleeping
+u32 spinThenWait(const std::atomic_uint32_t& value, u32 old, i32 spinIterations)
+{
+    for (i32 i = 0; i < spinIterations; i++)
+    {
+        u32 current = value.load(std::memory_order_acquire);
+        if (current != old)
+            return current;
+        spinPause();
+    }
+    value.wait(old, std::memory_order_acquire);
+    return value.load(std::memory_order_acquire);
+}
+
+}
+
+ThreadPool::ThreadPool(u32 concurrency, bool pinThreads)
+    : m_Concurrency(std::max(concurrency, 1u)), m_Slots(new WorkerSlot[m_Concurrency])
 {
-    for (u32 i = 0; i < concurrency; i++)
+    if (pinThreads)
+    {
+        choosePlacements();
+        if (!pinCurrentThread(m_Placements[0].cpu))
+            std::cout << "Warning: could not pin thread 0" << std::endl;
+    }
+
+    // spinning only steals time from the threads being waited on if they share cores
+    m_SpinIterations = std::thread::hardware_concurrency() >= m_Concurrency ? SPIN_ITERATIONS : 0;
+    // thread 0 is the caller
+    for (u32 threadID = 1; threadID < m_Concurrency; threadID++)
     {
         m_Threads.push_back(std::thread(
-            [this]
+            [this, threadID]
             {
-                threadLoop();
+                workerLoop(threadID);
             }));
     }
 }
 
 ThreadPool::~ThreadPool()
 {
-    stop();
+    m_ShouldStop = true;
+    for (u32 threadID = 1; threadID < m_Concurrency; threadID++)
+    {
+        m_Slots[threadID].sequence.fetch_add(1, std::memory_order_release);
+        m_Slots[threadID].sequence.notify_one();
+    }
+    for (auto& thread : m_Threads)
+        thread.join();
 }
 
-void ThreadPool::wait()
+void ThreadPool::choosePlacements()
 {
-    std::unique_lock<std::mutex> uniqueLock(m_QueueLock);
-    m_CV.wait(uniqueLock,
-        [this]()
-        {
-            return m_Tasks.size() == 0 && m_RunningTasks == 0;
-        });
-}
+    CpuTopology topology = detectTopology();
+    std::cout << "Topology: " << topology.nodes.size() << " numa node(s)" << std::endl;
+    for (const NumaNode& node : topology.nodes)
+        std::cout << "  node " << node.id << ": cpus " << formatCpuList(node.cpus) << std::endl;
 
-void ThreadPool::addTask(const std::function<void()>& task)
-{
-    std::lock_guard guard(m_QueueLock);
-    m_Tasks.push_back(task);
-    m_CV.notify_one();
+    // threads are spread evenly over the nodes in contiguous groups, so contiguous
+    // ranges of work (and the memory they first touch) stay on one node
+    u32 numNodes = static_cast<u32>(topology.nodes.size());
+    for (u32 threadID = 0; threadID < m_Concurrency; threadID++)
+    {
+        u32 nodeIdx = threadID * numNodes / m_Concurrency;
+        u32 firstInNode = (nodeIdx * m_Concurrency + numNodes - 1) / numNodes;
+        const NumaNode& node = topology.nodes[nodeIdx];
+        u32 cpu = node.cpus[(threadID - firstInNode) % node.cpus.size()];
+        m_Placements.push_back({cpu, node.id});
+    }
+
+    std::cout << "Placement:";
+    for (u32 threadID = 0; threadID < m_Concurrency; threadID++)
+        std::cout << " t" << threadID << "->cpu" << m_Placements[threadID].cpu << "(node"
+                  << m_Placements[threadID].node << ")";
+    std::cout << std::endl;
 }
 
-void ThreadPool::stop()
+void ThreadPool::dispatch(JobFn fn, void* context)
 {
-    m_ShouldStop = true;
-    m_CV.notify_all();
-    for (auto& thread : m_Threads)
-        thread.join();
+    m_JobFn = fn;
+    m_JobContext = context;
+    m_Remaining.store(m_Concurrency - 1, std::memory_order_relaxed);
+    // the release publishes the job to the worker
+    for (u32 threadID = 1; threadID < m_Concurrency; threadID++)
+    {
+        m_Slots[threadID].sequence.fetch_add(1, std::memory_order_release);
+        m_Slots[threadID].sequence.notify_one();
+    }
+
+    fn(context, 0);
+
+    u32 remaining = m_Remaining.load(std::memory_order_acquire);
+    while (remaining != 0)
+        remaining = spinThenWait(m_Remaining, remaining, m_SpinIterations);
 }
 
-void ThreadPool::threadLoop()
+void ThreadPool::workerLoop(u32 threadID)
 {
+    if (pinned() && !pinCurrentThread(m_Placements[threadID].cpu))
+        std::cout << "Warning: could not pin thread " << threadID << std::endl;
+
+    WorkerSlot& slot = m_Slots[threadID];
+    u32 sequence = 0;
     while (true)
     {
-        std::unique_lock<std::mutex> uniqueLock(m_QueueLock);
-        m_CV.notify_all();
-        m_CV.wait(uniqueLock,
-            [this]()
-            {
-                return m_ShouldStop || m_Tasks.size() > 0;
-            });
-
+        sequence = spinThenWait(slot.sequence, sequence, m_SpinIterations);
         if (m_ShouldStop)
             return;
 
-        std::function<void()> task = m_Tasks.front();
-        m_Tasks.pop_front();
-        m_RunningTasks++;
-        uniqueLock.unlock();
-
-        task();
+        m_JobFn(m_JobContext, threadID);
 
-        m_RunningTasks--;
+        if (m_Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            m_Remaining.notify_one();
     }
 }
@@ -2,35 +2,98 @@
 
 #include "sirius/defs.h"
 
-#include <condition_variable>
-#include <deque>
-#include <functional>
-#include <mutex>
+#include <atomic>
+#include <memory>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+// fork-join executor, every job runs once on each of the concurrency() threads
+// the calling thread takes part as thread 0, the workers spin for a while after
+// finishing a job and only then go to sleep, so back to back jobs are cheap to dispatch
 class ThreadPool
 {
 public:
-    ThreadPool(u32 concurrency);
+    // with pinThreads, consecutive threads are pinned to cpus of the same numa node
+    // and the topology and placement are printed
+    ThreadPool(u32 concurrency, bool pinThreads = false);
     ~ThreadPool();
 
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
     u32 concurrency() const
     {
-        return m_Threads.size();
+        return m_Concurrency;
+    }
+
+    bool pinned() const
+    {
+        return !m_Placements.empty();
+    }
+
+    // numa node the thread is pinned to, 0 if threads are not pinned
+    u32 threadNode(u32 threadID) const
+    {
+        return pinned() ? m_Placements[threadID].node : 0;
+    }
+
+    // calls fn(threadID) on every thread and returns once all of them are done
+    template<typename Fn>
+    void run(Fn&& fn)
+    {
+        using FnType = std::remove_reference_t<Fn>;
+        dispatch(
+            [](void* context, u32 threadID)
+            {
+                (*static_cast<FnType*>(context))(threadID);
+            },
+            const_cast<void*>(static_cast<const void*>(&fn)));
     }
 
-    void wait();
-    void addTask(const std::function<void()>& task);
+    // splits [begin, end) into concurrency() contiguous ranges
+    // and calls fn(threadID, rangeBegin, rangeEnd) for each of them
+    template<typename Fn>
+    void parallelFor(usize begin, usize end, Fn&& fn)
+    {
+        run(
+            [this, begin, end, &fn](u32 threadID)
+            {
+                usize size = end - begin;
+                usize rangeBegin = begin + size * threadID / m_Concurrency;
+                usize rangeEnd = begin + size * (threadID + 1) / m_Concurrency;
+                fn(threadID, rangeBegin, rangeEnd);
+            });
+    }
 
 private:
-    void stop();
-    void threadLoop();
+    using JobFn = void (*)(void* context, u32 threadID);
+
+    struct ThreadPlacement
+    {
+        u32 cpu;
+        u32 node;
+    };
+
+    // one per worker, on its own cache line so waiting workers don't share one
+    struct alignas(64) WorkerSlot
+    {
+        // bumped once for every job
+        std::atomic_uint32_t sequence = 0;
+    };
+
+    void choosePlacements();
+    void dispatch(JobFn fn, void* context);
+    void workerLoop(u32 threadID);
+
+    u32 m_Concurrency;
+    i32 m_SpinIterations;
+    JobFn m_JobFn = nullptr;
+    void* m_JobContext = nullptr;
+    bool m_ShouldStop = false;
 
-    std::atomic_bool m_ShouldStop;
-    std::condition_variable m_CV;
+    std::vector<ThreadPlacement> m_Placements;
+    std::unique_ptr<WorkerSlot[]> m_Slots;
+    alignas(64) std::atomic_uint32_t m_Remaining = 0;
     std::vector<std::thread> m_Threads;
-    std::mutex m_QueueLock;
-    std::atomic_uint32_t m_RunningTasks;
-    std::deque<std::function<void()>> m_Tasks;
 };
@@ -0,0 +1,132 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+
+// parses the sysfs cpulist format, e.g. "0-3,8-11"
+std::vector<u32> parseCpuList(const std::string& list)
+{
+    std::vector<u32> cpus;
+    const char* ptr = list.data();
+    const char* end = list.data() + list.size();
+    while (ptr < end)
+    {
+        u32 first = 0, last = 0;
+        auto result = std::from_chars(ptr, end, first);
+        if (result.ec != std::errc())
+            break;
+        ptr = result.ptr;
+        last = first;
+        if (ptr < end && *ptr == '-')
+        {
+            result = std::from_chars(ptr + 1, end, last);
+            if (result.ec != std::errc())
+                break;
+            ptr = result.ptr;
+        }
+        for (u32 cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+        if (ptr < end && *ptr == ',')
+            ptr++;
+        else
+            break;
+    }
+    return cpus;
+}
+
+CpuTopology singleNode()
+{
+    CpuTopology topology;
+    NumaNode node = {0, {}};
+    for (u32 cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); cpu++)
+        node.cpus.push_back(cpu);
+    topology.nodes.push_back(node);
+    return topology;
+}
+
+}
+
+CpuTopology detectTopology()
+{
+#ifdef __linux__
+    namespace fs = std::filesystem;
+    CpuTopology topology;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator("/sys/devices/system/node", ec))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0)
+            continue;
+        u32 id;
+        auto [ptr, parseEc] = std::from_chars(name.data() + 4, name.data() + name.size(), id);
+        if (parseEc != std::errc() || ptr != name.data() + name.size())
+            continue;
+
+        std::ifstream file(entry.path() / "cpulist");
+        std::string list;
+        std::getline(file, list);
+        NumaNode node = {id, parseCpuList(list)};
+        // memory only nodes have no cpus
+        if (!node.cpus.empty())
+            topology.nodes.push_back(node);
+    }
+    if (!topology.nodes.empty())
+    {
+        std::sort(topology.nodes.begin(), topology.nodes.end(),
+            [](const NumaNode& a, const NumaNode& b)
+            {
+                return a.id < b.id;
+            });
+        return topology;
+    }
+#endif
+    return singleNode();
+}
+
+std::string formatCpuList(const std::vector<u32>& cpus)
+{
+    std::string result;
+    for (size_t i = 0; i < cpus.size();)
+    {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            j++;
+        if (!result.empty())
+            result += ',';
+        result += std::to_string(cpus[i]);
+        if (j > i)
+            result += '-' + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return result;
+}
+
+bool pinCurrentThread(u32 cpu)
+{
+#ifdef _WIN32
+    if (cpu >= 64)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sirius/defs.h"
+
+#include <string>
+#include <vector>
+
+struct NumaNode
+{
+    u32 id;
+    std::vector<u32> cpus;
+};
+
+struct CpuTopology
+{
+    std::vector<NumaNode> nodes;
+};
+
+// reads the numa nodes from sysfs on linux
+// elsewhere, or if that fails, all cpus are reported as a single node
+CpuTopology detectTopology();
+std::string formatCpuList(const std::vector<u32>& cpus);
+
+// pins the calling thread to cpu, returns false if that is not supported or failed
+bool pinCurrentThread(u32 cpu);
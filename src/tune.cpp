@@ -1,97 +1,112 @@
 #include "tune.h"
+#include "dataset_stream.h"
 #include "eval_fn.h"
-#include "settings.h"
+#include "gradient_arena.h"
+#include "sirius/util/prng.h"
 #include "thread_pool.h"
+#include "tune_kernels.h"
 #include <chrono>
+#include <deque>
 #include <iostream>
+#include <type_traits>
 
-double sigmoid(double x, double k)
-{
-    return 1.0 / (1 + exp(-x * k));
-}
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
 
-double safetyFnMg(double raw)
-{
-    return raw / 8.0 + std::max(raw, 0.0) * raw / 1024;
-}
+constexpr double BETA1 = 0.9, BETA2 = 0.999;
+constexpr double EPSILON = 1e-8;
 
-double safetyFnEg(double raw)
+void adamUpdate(
+    EvalParam& param, Gradient& momentum, Gradient& velocity, const Gradient& gradient, double lr)
 {
-    return raw / 8.0 + std::max(raw, 0.0) * raw / 1024;
-}
+    momentum.mg = BETA1 * momentum.mg + (1 - BETA1) * gradient.mg;
+    momentum.eg = BETA1 * momentum.eg + (1 - BETA1) * gradient.eg;
 
-double safetyDerivMg(double raw)
-{
-    return 1.0 / 8.0 + 2.0 * std::max(raw, 0.0) / 1024;
-}
+    velocity.mg = BETA2 * velocity.mg + (1 - BETA2) * gradient.mg * gradient.mg;
+    velocity.eg = BETA2 * velocity.eg + (1 - BETA2) * gradient.eg * gradient.eg;
 
-double safetyDerivEg(double raw)
-{
-    return 1.0 / 8.0 + 2.0 * std::max(raw, 0.0) / 1024;
+    param.mg -= lr * momentum.mg / (std::sqrt(velocity.mg) + EPSILON);
+    param.eg -= lr * momentum.eg / (std::sqrt(velocity.eg) + EPSILON);
 }
 
-double trainingTarget(const Position& pos, double wdlLambda, double kValue, double scoreKValue)
+// applies the adam steps a param skipped in sparse mode, where its gradient was 0
+// the moments just decay, so the skipped param updates form a geometric series with
+// ratio BETA1 / sqrt(BETA2), as long as EPSILON is ignored
+void adamCatchUp(EvalParam& param, Gradient& momentum, Gradient& velocity, i32 steps, double lr)
 {
-    return wdlLambda * pos.wdl + (1 - wdlLambda) * sigmoid(pos.score, scoreKValue);
+    if (steps <= 0)
+        return;
+    const double RATIO = BETA1 / std::sqrt(BETA2);
+    double ratioPow = std::pow(RATIO, steps);
+    double seriesSum = RATIO * (1 - ratioPow) / (1 - RATIO);
+
+    if (velocity.mg > 0)
+        param.mg -= lr * seriesSum * momentum.mg / std::sqrt(velocity.mg);
+    if (velocity.eg > 0)
+        param.eg -= lr * seriesSum * momentum.eg / std::sqrt(velocity.eg);
+
+    double momentumDecay = std::pow(BETA1, steps);
+    double velocityDecay = std::pow(BETA2, steps);
+    momentum = {momentum.mg * momentumDecay, momentum.eg * momentumDecay};
+    velocity = {velocity.mg * velocityDecay, velocity.eg * velocityDecay};
 }
 
-struct EvalTrace
+// the positions being tuned on, either all in memory or streamed from a dataset cache
+class TuneData
 {
-    struct TraceElem
+public:
+    TuneData(std::span<const Position> positions, std::span<const float> weights,
+        Coeffs coefficients)
+        : m_Positions(positions), m_Weights(weights), m_Coefficients(coefficients),
+          m_TotalWeight(sumWeights(positions.size(), weights))
     {
-        double mg;
-        double eg;
-    };
-    TraceElem normal;
-    ColorArray<TraceElem> rawSafety;
-    TraceElem nonComplexity;
-    TraceElem complexity;
-};
+    }
 
-double evaluate(const Position& pos, Coeffs coefficients, const EvalParams& params, EvalTrace& trace)
-{
-    for (i32 i = pos.coeffBegin; i < pos.coeffEnd; i++)
+    TuneData(DatasetStream& stream)
+        : m_Stream(&stream)
     {
-        const auto& coeff = coefficients[i];
-        const EvalParam& param = params[coeff.index];
-        if (param.type == ParamType::NORMAL)
-        {
-            trace.normal.mg += param.mg * (coeff.white - coeff.black);
-            trace.normal.eg += param.eg * (coeff.white - coeff.black);
-        }
-        else if (param.type == ParamType::COMPLEXITY)
-        {
-            // complexity has no white/black separation, only white part is used
-            trace.complexity.eg += param.eg * coeff.white;
-        }
-        else if (param.type == ParamType::SAFETY)
-        {
-            trace.rawSafety[Color::WHITE].mg += param.mg * coeff.white;
-            trace.rawSafety[Color::WHITE].eg += param.eg * coeff.white;
-            trace.rawSafety[Color::BLACK].mg += param.mg * coeff.black;
-            trace.rawSafety[Color::BLACK].eg += param.eg * coeff.black;
-        }
     }
 
-    double mg = 0, eg = 0;
-    mg += trace.normal.mg;
-    eg += trace.normal.eg;
-    mg += safetyFnMg(trace.rawSafety[Color::WHITE].mg);
-    mg -= safetyFnMg(trace.rawSafety[Color::BLACK].mg);
-    eg += safetyFnEg(trace.rawSafety[Color::WHITE].eg);
-    eg -= safetyFnEg(trace.rawSafety[Color::BLACK].eg);
-    trace.nonComplexity.mg = mg;
-    trace.nonComplexity.eg = eg;
-    eg += ((eg > 0) - (eg < 0)) * std::max(-std::abs(eg), trace.complexity.eg);
-
-    return (mg * pos.phase + eg * (1.0 - pos.phase));
-}
+    usize size() const
+    {
+        return m_Stream ? m_Stream->size() : m_Positions.size();
+    }
 
-double evaluate(const Position& pos, Coeffs coefficients, const EvalParams& params)
-{
-    EvalTrace trace = {};
-    return evaluate(pos, coefficients, params, trace);
-}
+    // the number of positions before deduplication
+    double totalWeight() const
+    {
+        return m_Stream ? m_Stream->totalWeight() : m_TotalWeight;
+    }
+
+    bool hasWeights() const
+    {
+        return m_Stream ? m_Stream->hasWeights() : !m_Weights.empty();
+    }
+
+    DatasetStream* stream()
+    {
+        return m_Stream;
+    }
+
+    // calls fn(positions, weights, coefficients) for each chunk,
+    // an in memory dataset is one chunk
+    template<typename Fn>
+    void forEachChunk(Fn&& fn)
+    {
+        if (m_Stream)
+            m_Stream->forEachChunk(fn);
+        else
+            fn(m_Positions, m_Weights, m_Coefficients);
+    }
+
+private:
+    std::span<const Position> m_Positions;
+    std::span<const float> m_Weights;
+    Coeffs m_Coefficients;
+    double m_TotalWeight = 0;
+    DatasetStream* m_Stream = nullptr;
+};
 
 enum class ErrorType
 {
@@ -100,41 +115,215 @@ enum class ErrorType
     SCORE_WDL
 };
 
-double calcError(ThreadPool& threadPool, std::span<const Position> positions, Coeffs coefficients,
-    double kValue, const EvalParams& params, ErrorType type, double scoreKValue)
+// weighted sum of the squared errors of the positions
+template<typename Real>
+double calcErrorSum(ThreadPool& threadPool, const TuneConfig& config,
+    std::span<const Position> positions, std::span<const float> weights, Coeffs coefficients,
+    double kValue, const PackedParam<Real>* packed, ErrorType type, double scoreKValue)
 {
+    const TuneKernels<Real>& kernels = bestKernels<Real>();
     std::vector<double> threadErrors(threadPool.concurrency());
+    threadPool.run(
+        [&](u32 threadID)
+        {
+            double error = 0.0;
+            std::array<double, 256> evals;
+            forEachThreadSlice(threadID, threadPool.concurrency(), positions.size(),
+                config.batchSize, [&](usize beginIdx, usize endIdx)
+                {
+                    for (size_t begin = beginIdx; begin < endIdx; begin += evals.size())
+                    {
+                        auto chunk
+                            = positions.subspan(begin, std::min(evals.size(), endIdx - begin));
+                        if (type != ErrorType::SCORE_WDL)
+                            kernels.evaluate(chunk, coefficients, packed, evals.data());
+
+                        for (size_t i = 0; i < chunk.size(); i++)
+                        {
+                            const Position& pos = chunk[i];
+                            double eval = type == ErrorType::SCORE_WDL ? pos.score : evals[i];
+                            double target = type == ErrorType::NORMAL
+                                ? trainingTarget(pos, config.wdlLambda, scoreKValue)
+                                : pos.wdl();
+                            double diff = sigmoid(eval, kValue) - target;
+                            error += weights.empty() ? diff * diff
+                                                     : weights[begin + i] * diff * diff;
+                        }
+                    }
+                });
+            threadErrors[threadID] = error;
+        });
+    double error = 0.0;
     for (u32 threadID = 0; threadID < threadPool.concurrency(); threadID++)
+        error += threadErrors[threadID];
+    return error;
+}
+
+// evaluates the positions again, only used to check the drift of the single precision path
+template<typename Real>
+double calcError(ThreadPool& threadPool, const TuneConfig& config, TuneData& data,
+    double kValue, const EvalParams& params, ErrorType type, double scoreKValue)
+{
+    std::vector<PackedParam<Real>> packed;
+    packParams(params, packed);
+    double error = 0.0;
+    data.forEachChunk(
+        [&](std::span<const Position> positions, std::span<const float> weights,
+            Coeffs coefficients)
+        {
+            error += calcErrorSum(threadPool, config, positions, weights, coefficients, kValue,
+                packed.data(), type, scoreKValue);
+        });
+    return error / data.totalWeight();
+}
+
+// the evals of every position in a flat float array, indexed like the positions of the
+// whole dataset. they are computed once per param set by evaluate(), after which any number
+// of error passes only read them and the labels of the positions, not the coefficients.
+// the array isn't zeroed, so each thread's slice is first touched by the thread that
+// evaluates and reads it. a streamed dataset keeps nothing outside of its memory budget,
+// so its error passes evaluate every chunk again instead
+template<typename Real>
+class EvalCache
+{
+public:
+    EvalCache(const TuneConfig& config, TuneData& data)
+        : m_BatchSize(config.batchSize),
+          m_TotalWeight(data.totalWeight()),
+          m_WdlLambda(config.wdlLambda),
+          m_Resident(!data.stream())
+    {
+        if (m_Resident)
+            m_Evals.resize(data.size());
+    }
+
+    // for the targets of ErrorType::NORMAL
+    void setScoreKValue(double scoreKValue)
     {
-        size_t beginIdx = positions.size() * threadID / threadPool.concurrency();
-        size_t endIdx = positions.size() * (threadID + 1) / threadPool.concurrency();
-        std::span<const Position> threadPositions = positions.subspan(beginIdx, endIdx - beginIdx);
-        threadPool.addTask(
-            [threadID, &threadErrors, threadPositions, coefficients, kValue, &params, type, scoreKValue]()
+        m_ScoreKValue = scoreKValue;
+    }
+
+    void evaluate(ThreadPool& threadPool, TuneData& data, const EvalParams& params)
+    {
+        packParams(params, m_Packed);
+        if (!m_Resident)
+            return;
+        const TuneKernels<Real>& kernels = bestKernels<Real>();
+        forEachSlice(threadPool, data,
+            [&](u32, std::span<const Position> positions, std::span<const float>,
+                Coeffs coefficients, usize offset)
             {
-                double error = 0.0;
-                for (auto& pos : threadPositions)
+                std::array<double, 256> evals;
+                for (usize begin = 0; begin < positions.size(); begin += evals.size())
                 {
-                    double eval = type == ErrorType::SCORE_WDL ? pos.score
-                                                               : evaluate(pos, coefficients, params);
-                    double target = type == ErrorType::NORMAL
-                        ? trainingTarget(pos, WDL_LAMBDA, kValue, scoreKValue)
-                        : pos.wdl;
-                    double diff = sigmoid(eval, kValue) - target;
-                    error += diff * diff;
+                    auto chunk = positions.subspan(
+                        begin, std::min(evals.size(), positions.size() - begin));
+                    kernels.evaluate(chunk, coefficients, m_Packed.data(), evals.data());
+                    for (usize i = 0; i < chunk.size(); i++)
+                        m_Evals[offset + begin + i] = static_cast<float>(evals[i]);
                 }
-                threadErrors[threadID] = error;
             });
     }
-    threadPool.wait();
-    double error = 0.0;
-    for (u32 threadID = 0; threadID < threadPool.concurrency(); threadID++)
-        error += threadErrors[threadID];
-    return error / static_cast<double>(positions.size());
-}
 
-double findKValue(ThreadPool& threadPool, std::span<const Position> positions, Coeffs coefficients,
-    const EvalParams& params, ErrorType type, double scoreKValue)
+    // mean squared error for every k value, with the params of the last evaluate()
+    std::vector<double> errors(ThreadPool& threadPool, TuneData& data,
+        std::span<const double> kValues, ErrorType type) const
+    {
+        const TuneKernels<Real>& kernels = bestKernels<Real>();
+        std::vector<std::vector<double>> threadErrors(
+            threadPool.concurrency(), std::vector<double>(kValues.size(), 0.0));
+        forEachSlice(threadPool, data,
+            [&](u32 threadID, std::span<const Position> positions, std::span<const float> weights,
+                Coeffs coefficients, usize offset)
+            {
+                std::vector<double>& error = threadErrors[threadID];
+                std::array<double, 256> evals;
+                for (usize begin = 0; begin < positions.size(); begin += evals.size())
+                {
+                    auto chunk = positions.subspan(
+                        begin, std::min(evals.size(), positions.size() - begin));
+                    if (type == ErrorType::SCORE_WDL)
+                    {
+                        for (usize i = 0; i < chunk.size(); i++)
+                            evals[i] = chunk[i].score;
+                    }
+                    else if (m_Resident)
+                        std::copy_n(m_Evals.begin() + offset + begin, chunk.size(), evals.begin());
+                    else
+                        kernels.evaluate(chunk, coefficients, m_Packed.data(), evals.data());
+
+                    for (usize i = 0; i < chunk.size(); i++)
+                    {
+                        const Position& pos = chunk[i];
+                        double target = type == ErrorType::NORMAL
+                            ? trainingTarget(pos, m_WdlLambda, m_ScoreKValue)
+                            : pos.wdl();
+                        double weight = weights.empty() ? 1.0 : weights[begin + i];
+                        for (usize k = 0; k < kValues.size(); k++)
+                        {
+                            double diff = sigmoid(evals[i], kValues[k]) - target;
+                            error[k] += weight * diff * diff;
+                        }
+                    }
+                }
+            });
+
+        std::vector<double> errors(kValues.size());
+        for (usize k = 0; k < kValues.size(); k++)
+        {
+            double error = 0.0;
+            for (u32 threadID = 0; threadID < threadPool.concurrency(); threadID++)
+                error += threadErrors[threadID][k];
+            errors[k] = error / m_TotalWeight;
+        }
+        return errors;
+    }
+
+    double error(ThreadPool& threadPool, TuneData& data, double kValue, ErrorType type) const
+    {
+        return errors(threadPool, data, std::span(&kValue, 1), type)[0];
+    }
+
+private:
+    // calls fn(threadID, positions, weights, coefficients, offset) for every thread's share
+    // of each batch, offset is the index of the first position in the whole dataset
+    template<typename Fn>
+    void forEachSlice(ThreadPool& threadPool, TuneData& data, Fn&& fn) const
+    {
+        usize offset = 0;
+        data.forEachChunk(
+            [&](std::span<const Position> positions, std::span<const float> weights,
+                Coeffs coefficients)
+            {
+                threadPool.run(
+                    [&](u32 threadID)
+                    {
+                        forEachThreadSlice(threadID, threadPool.concurrency(), positions.size(),
+                            m_BatchSize, [&](usize begin, usize end)
+                            {
+                                fn(threadID, positions.subspan(begin, end - begin),
+                                    weights.empty() ? weights : weights.subspan(begin, end - begin),
+                                    coefficients, offset + begin);
+                            });
+                    });
+                offset += positions.size();
+            });
+    }
+
+    usize m_BatchSize;
+    double m_TotalWeight;
+    double m_WdlLambda;
+    double m_ScoreKValue = 0.0;
+    bool m_Resident;
+    std::vector<float, AlignedAllocator<float>> m_Evals;
+    std::vector<PackedParam<Real>> m_Packed;
+};
+
+// grid search that narrows down around the best k, with the evals in the cache
+// all the k values of an iteration share one pass over the cache
+template<typename Real>
+double findKValue(
+    ThreadPool& threadPool, TuneData& data, const EvalCache<Real>& cache, ErrorType type)
 {
     constexpr double SEARCH_MAX = 0.1;
     constexpr i32 ITERATIONS = 7;
@@ -151,21 +340,24 @@ double findKValue(ThreadPool& threadPool, std::span<const Position> positions, C
         std::cout << "Finding score k" << std::endl;
     }
 
+    std::vector<double> kValues;
     for (i32 i = 0; i < ITERATIONS; i++)
     {
         std::cout << "Iteration: " << i << std::endl;
         std::cout << "Start: " << start + step << " End: " << end + step << " Step: " << step
                   << std::endl;
+        kValues.clear();
         for (double curr = start + step; curr < end + step; curr += step)
+            kValues.push_back(curr);
+        std::vector<double> errors = cache.errors(threadPool, data, kValues, type);
+        for (size_t k = 0; k < kValues.size(); k++)
         {
-            double error =
-                calcError(threadPool, positions, coefficients, curr, params, type, scoreKValue);
-            std::cout << "K: " << curr << " Error: " << error << std::endl;
-            if (error < bestError)
+            std::cout << "K: " << kValues[k] << " Error: " << errors[k] << std::endl;
+            if (errors[k] < bestError)
             {
                 std::cout << "New best" << std::endl;
-                bestError = error;
-                bestK = curr;
+                bestError = errors[k];
+                bestK = kValues[k];
             }
         }
 
@@ -177,157 +369,325 @@ double findKValue(ThreadPool& threadPool, std::span<const Position> positions, C
     return bestK;
 }
 
-void updateGradient(const Position& pos, Coeffs coefficients, double kValue,
-    const EvalParams& params, std::vector<Gradient>& gradients, double scoreKValue)
+// splits each chunk into blocks of consecutive positions and groups them into batches. the
+// positions that don't fill a whole batch are spread over the others instead of being
+// skipped, a small batch would get as large an adam step as a full one. with shuffling,
+// the blocks are visited in a new random order every epoch. a block's positions and
+// coefficients stay contiguous, so a batch still reads a few long runs of memory rather
+// than one scattered position at a time
+class BatchScheduler
 {
-    EvalTrace trace = {};
-    double eval = evaluate(pos, coefficients, params, trace);
-    double wdl = sigmoid(eval, kValue);
-    double target = trainingTarget(pos, WDL_LAMBDA, kValue, scoreKValue);
-    double gradientBase = (wdl - target) * (wdl * (1 - wdl));
-    double mgBase = gradientBase * pos.phase;
-    double egBase = (gradientBase - mgBase) * pos.egScale;
-    for (i32 i = pos.coeffBegin; i < pos.coeffEnd; i++)
+public:
+    // enough blocks per batch that every thread gets a part of a few of them
+    static constexpr usize MIN_BLOCKS_PER_BATCH = 64;
+
+    // with threadLocal, blocks are only shuffled among those of the same thread's slices
+    BatchScheduler(usize batchSize, u32 concurrency, bool shuffle, bool threadLocal)
+        : m_Shuffle(shuffle), m_ThreadLocal(threadLocal), m_Concurrency(concurrency)
     {
-        const auto& coeff = coefficients[i];
-        ParamType type = params[coeff.index].type;
-        if (type == ParamType::NORMAL)
-        {
-            if (trace.complexity.mg >= -std::abs(trace.nonComplexity.mg))
-                gradients[coeff.index].mg += (coeff.white - coeff.black) * mgBase;
-            if (trace.complexity.eg >= -std::abs(trace.nonComplexity.eg))
-                gradients[coeff.index].eg += (coeff.white - coeff.black) * egBase;
-        }
-        else if (type == ParamType::SAFETY)
+        // without shuffling, a batch is one block, and the leftover block joins the last batch
+        usize blocksPerBatch =
+            shuffle ? std::max<usize>(MIN_BLOCKS_PER_BATCH, concurrency) : 1;
+        m_BatchSize = batchSize;
+        m_BlockSize = std::max<usize>(batchSize / blocksPerBatch, 1);
+        m_Prng.seed(0x5EED);
+    }
+
+    // calls fn(blocks, numPositions) for every batch of a chunk of numPositions positions
+    template<typename Fn>
+    void forEachBatch(usize numPositions, Fn&& fn)
+    {
+        usize numBatches = std::max<usize>(numPositions / m_BatchSize, 1);
+        if (m_Shuffle && m_ThreadLocal)
+            orderThreadLocal(numPositions, numBatches);
+        else
         {
-            if (trace.complexity.mg >= -std::abs(trace.nonComplexity.mg))
-            {
-                gradients[coeff.index].mg +=
-                    coeff.white * mgBase * safetyDerivMg(trace.rawSafety[Color::WHITE].mg);
-                gradients[coeff.index].mg -=
-                    coeff.black * mgBase * safetyDerivMg(trace.rawSafety[Color::BLACK].mg);
-            }
-            if (trace.complexity.eg >= -std::abs(trace.nonComplexity.eg))
-            {
-                gradients[coeff.index].eg +=
-                    coeff.white * egBase * safetyDerivEg(trace.rawSafety[Color::WHITE].eg);
-                gradients[coeff.index].eg -=
-                    coeff.black * egBase * safetyDerivEg(trace.rawSafety[Color::BLACK].eg);
-            }
+            m_Blocks.clear();
+            for (usize begin = 0; begin < numPositions; begin += m_BlockSize)
+                m_Blocks.push_back({begin, std::min(begin + m_BlockSize, numPositions)});
+            if (m_Shuffle)
+                shuffleBlocks(m_Blocks.begin(), m_Blocks.end());
+            m_BatchEnds.clear();
+            for (usize batch = 0; batch < numBatches; batch++)
+                m_BatchEnds.push_back(m_Blocks.size() * (batch + 1) / numBatches);
         }
-        else if (type == ParamType::COMPLEXITY)
+
+        usize first = 0;
+        for (usize last : m_BatchEnds)
         {
-            if (trace.complexity.eg >= -std::abs(trace.nonComplexity.eg))
-                gradients[coeff.index].eg +=
-                    coeff.white * egBase * ((trace.normal.eg > 0) - (trace.normal.eg < 0));
+            auto blocks = std::span<const PositionBlock>(m_Blocks).subspan(first, last - first);
+            usize batchPositions = 0;
+            for (const PositionBlock& block : blocks)
+                batchPositions += block.end - block.begin;
+            fn(blocks, batchPositions);
+            first = last;
         }
     }
-}
 
-void computeGradient(ThreadPool& threadPool, std::span<const Position> positions, Coeffs coefficients,
-    double kValue, const EvalParams& params, std::vector<Gradient>& gradients, double scoreKValue)
-{
-    std::fill(gradients.begin(), gradients.end(), Gradient{0, 0});
-
-    std::vector<std::vector<Gradient>> threadGradients(threadPool.concurrency(), gradients);
+private:
+    template<typename It>
+    void shuffleBlocks(It begin, It end)
+    {
+        usize size = static_cast<usize>(end - begin);
+        for (usize i = 0; i + 1 < size; i++)
+            std::swap(begin[i], begin[i + m_Prng.next64() % (size - i)]);
+    }
 
-    for (u32 threadID = 0; threadID < threadPool.concurrency(); threadID++)
+    // each thread's blocks come from its forEachThreadSlice ranges, which placeDataset put on
+    // its numa node, and are shuffled among themselves. every batch takes an even share of
+    // each thread's blocks in thread order, so forEachBlockSlice gives a thread its own
+    // blocks, apart from the rounding of the shares at either end of them
+    void orderThreadLocal(usize numPositions, usize numBatches)
     {
-        size_t beginIdx = positions.size() * threadID / threadPool.concurrency();
-        size_t endIdx = positions.size() * (threadID + 1) / threadPool.concurrency();
-        std::span<const Position> threadPositions = positions.subspan(beginIdx, endIdx - beginIdx);
-        threadPool.addTask(
-            [threadID, &threadGradients, threadPositions, coefficients, kValue, &params, scoreKValue]()
+        m_ThreadBlocks.clear();
+        m_ThreadEnds.clear();
+        for (u32 threadID = 0; threadID < m_Concurrency; threadID++)
+        {
+            usize threadBegin = m_ThreadBlocks.size();
+            forEachThreadSlice(threadID, m_Concurrency, numPositions, m_BatchSize,
+                [&](usize begin, usize end)
+                {
+                    for (usize block = begin; block < end; block += m_BlockSize)
+                        m_ThreadBlocks.push_back({block, std::min(block + m_BlockSize, end)});
+                });
+            shuffleBlocks(m_ThreadBlocks.begin() + threadBegin, m_ThreadBlocks.end());
+            m_ThreadEnds.push_back(m_ThreadBlocks.size());
+        }
+
+        m_Blocks.clear();
+        m_BatchEnds.clear();
+        for (usize batch = 0; batch < numBatches; batch++)
+        {
+            usize threadBegin = 0;
+            for (usize threadEnd : m_ThreadEnds)
             {
-                for (const auto& pos : threadPositions)
-                    updateGradient(
-                        pos, coefficients, kValue, params, threadGradients[threadID], scoreKValue);
-            });
+                usize count = threadEnd - threadBegin;
+                m_Blocks.insert(m_Blocks.end(),
+                    m_ThreadBlocks.begin() + threadBegin + count * batch / numBatches,
+                    m_ThreadBlocks.begin() + threadBegin + count * (batch + 1) / numBatches);
+                threadBegin = threadEnd;
+            }
+            m_BatchEnds.push_back(m_Blocks.size());
+        }
     }
 
-    threadPool.wait();
+    bool m_Shuffle;
+    bool m_ThreadLocal;
+    u32 m_Concurrency;
+    usize m_BatchSize;
+    usize m_BlockSize;
+    PRNG m_Prng;
+    std::vector<PositionBlock> m_Blocks;
+    // index into m_Blocks after the last block of each batch
+    std::vector<usize> m_BatchEnds;
+    // thread local shuffling only
+    std::vector<PositionBlock> m_ThreadBlocks;
+    std::vector<usize> m_ThreadEnds;
+};
+
+double sumBlockWeights(std::span<const PositionBlock> blocks, std::span<const float> weights)
+{
+    double sum = 0.0;
+    for (const PositionBlock& block : blocks)
+        sum += sumWeights(block.end - block.begin,
+            weights.empty() ? weights : weights.subspan(block.begin, block.end - block.begin));
+    return sum;
+}
 
-    for (u32 i = 0; i < gradients.size(); i++)
+// asks for the start of a block's positions and coefficients, so the jump to it doesn't
+// stall. the hardware prefetcher picks up the rest of each sequential run
+void prefetchBlock(std::span<const Position> positions, Coeffs coefficients, usize begin)
+{
+    constexpr usize LINES = 4;
+    const Position& first = positions[begin];
+    for (usize line = 0; line < LINES; line++)
     {
-        Gradient grad = {};
-        for (u32 threadID = 0; threadID < threadPool.concurrency(); threadID++)
-        {
-            grad.mg += threadGradients[threadID][i].mg;
-            grad.eg += threadGradients[threadID][i].eg;
-        }
-        // technically, this is actually the gradient multiplied by 0.5
-        grad.mg = grad.mg * kValue / positions.size();
-        grad.eg = grad.eg * kValue / positions.size();
-        gradients[i] = grad;
+        const char* pos = reinterpret_cast<const char*>(&first) + line * CACHE_LINE_SIZE;
+        const char* coeff = reinterpret_cast<const char*>(coefficients.data() + first.coeffBegin)
+            + line * CACHE_LINE_SIZE;
+#if defined(_MSC_VER)
+        _mm_prefetch(pos, _MM_HINT_T0);
+        _mm_prefetch(coeff, _MM_HINT_T0);
+#else
+        __builtin_prefetch(pos);
+        __builtin_prefetch(coeff);
+#endif
     }
 }
 
-EvalParams tune(const Dataset& dataset, std::ofstream& outFile)
+// per thread sums are kept at Real precision, the reduction is always done in double
+// returns the weighted sum of the squared errors of the positions, with the params the
+// gradient was computed at
+template<typename Real, bool SPARSE>
+double computeGradient(ThreadPool& threadPool, const TuneConfig& config,
+    std::span<const Position> positions, std::span<const float> weights,
+    std::span<const PositionBlock> blocks, usize numPositions, double totalWeight,
+    Coeffs coefficients, double kValue, const PackedParam<Real>* params,
+    GradientArena<Real>& arena, std::vector<Gradient>& gradients, double scoreKValue)
 {
-    ThreadPool threadPool(TUNE_THREADS);
-    EvalParams params = EvalFn::getInitialParams();
-    double scoreKValue = findKValue(threadPool, dataset.positions, dataset.allCoefficients,
-        EvalFn::getKParams(), ErrorType::SCORE_WDL, 0.0);
-    double originalKValue = findKValue(threadPool, dataset.positions, dataset.allCoefficients,
-        EvalFn::getKParams(), ErrorType::EVAL_WDL, scoreKValue);
-    double kValue = TUNE_K <= 0 ? findKValue(threadPool, dataset.positions, dataset.allCoefficients,
-                                      EvalFn::getKParams(), ErrorType::NORMAL, scoreKValue)
-                                : TUNE_K;
+    const TuneKernels<Real>& kernels = bestKernels<Real>();
 
-    std::cout << "Final normal k value: " << kValue << std::endl;
-    std::cout << "Final wdl k value: " << originalKValue << std::endl;
-    std::cout << "Final score k value: " << scoreKValue << std::endl;
-    outFile << "Final k value: " << kValue << std::endl;
-    outFile << "Final wdl k value: " << originalKValue << std::endl;
-    outFile << "Final score k value: " << scoreKValue << std::endl;
+    threadPool.run(
+        [&](u32 threadID)
+        {
+            // each part is worked on while the next one is being fetched
+            std::vector<PositionBlock>& parts = arena.scratch(threadID).parts;
+            parts.clear();
+            forEachBlockSlice(threadID, threadPool.concurrency(), blocks, numPositions,
+                [&](usize begin, usize end)
+                {
+                    parts.push_back({begin, end});
+                });
 
-    if constexpr (TUNE_FROM_ZERO)
-        for (auto& param : params.linear)
-            param.mg = param.eg = 0;
-    else if constexpr (TUNE_FROM_MATERIAL)
-        params = EvalFn::getMaterialParams();
+            double error = 0.0;
+            for (usize i = 0; i < parts.size(); i++)
+            {
+                if (i + 1 < parts.size())
+                    prefetchBlock(positions, coefficients, parts[i + 1].begin);
+                auto [beginIdx, endIdx] = parts[i];
+                GradientArgs args = {kValue, scoreKValue, config.wdlLambda,
+                    weights.empty() ? nullptr : weights.data() + beginIdx};
+                error += kernels.updateGradients(positions.subspan(beginIdx, endIdx - beginIdx),
+                    coefficients, params, args, arena.thread(threadID));
+            }
+            arena.scratch(threadID).error = error;
+        });
 
-    constexpr double LR = TUNE_LR;
+    // technically, this is actually the gradient multiplied by 0.5
+    double scale = kValue / totalWeight;
+    if constexpr (SPARSE)
+        arena.reduceTouched(threadPool, gradients, scale);
+    else
+        arena.reduce(threadPool, gradients, scale);
+
+    double error = 0.0;
+    for (u32 threadID = 0; threadID < threadPool.concurrency(); threadID++)
+        error += arena.scratch(threadID).error;
+    return error;
+}
 
-    constexpr double BETA1 = 0.9, BETA2 = 0.999;
-    constexpr double EPSILON = 1e-8;
+// minibatch adam, the params are up to date when it returns
+template<typename Real, bool SPARSE>
+void runAdam(ThreadPool& threadPool, const TuneConfig& config, TuneData& data,
+    EvalCache<Real>& evalCache, EvalParams& params, double kValue, double scoreKValue,
+    std::ofstream& outFile)
+{
+    constexpr bool MIXED_PRECISION = !std::is_same_v<Real, double>;
 
     std::vector<Gradient> momentum(params.totalSize(), {0, 0});
     std::vector<Gradient> velocity(params.totalSize(), {0, 0});
     std::vector<Gradient> gradient(params.totalSize(), {0, 0});
+    std::vector<PackedParam<Real>> packed;
+    GradientArena<Real> arena(threadPool.concurrency(), params.totalSize());
+
+    // sparse mode only, the adam step each param was last brought up to date at
+    std::vector<i32> lastStep(params.totalSize(), 0);
+    i32 step = 0;
+    u64 touchedTotal = 0;
+    auto catchUpAll = [&]()
+    {
+        for (u32 i = 0; i < params.totalSize(); i++)
+        {
+            adamCatchUp(params[i], momentum[i], velocity[i], step - lastStep[i], config.lr);
+            lastStep[i] = step;
+        }
+    };
 
     auto t1 = std::chrono::steady_clock::now();
     auto startTime = t1;
 
-    for (i32 epoch = 1; epoch <= TUNE_MAX_EPOCHS; epoch++)
+    BatchScheduler scheduler(
+        config.batchSize, threadPool.concurrency(), config.shuffle, config.pinThreads);
+    for (i32 epoch = 1; epoch <= config.maxEpochs; epoch++)
     {
-        for (i32 batch = 0; batch < dataset.positions.size() / BATCH_SIZE; batch++)
-        {
-            std::span<const Position> batchPositions = {dataset.positions.begin() + batch * BATCH_SIZE,
-                std::min<size_t>(BATCH_SIZE, dataset.positions.size() - batch * BATCH_SIZE)};
-            computeGradient(threadPool, batchPositions, dataset.allCoefficients, kValue, params,
-                gradient, scoreKValue);
-
-            for (i32 i = 0; i < gradient.size(); i++)
+        // the error of each batch before its update, which is close to the error at the end
+        // of the epoch without another pass over the data
+        double epochError = 0.0;
+        double epochWeight = 0.0;
+        // chunks hold whole batches, so batches are the same as with an in memory dataset,
+        // except that shuffled blocks stay within their chunk
+        data.forEachChunk(
+            [&](std::span<const Position> positions, std::span<const float> weights,
+                Coeffs coefficients)
             {
-                momentum[i].mg = BETA1 * momentum[i].mg + (1 - BETA1) * gradient[i].mg;
-                momentum[i].eg = BETA1 * momentum[i].eg + (1 - BETA1) * gradient[i].eg;
+                scheduler.forEachBatch(positions.size(),
+                    [&](std::span<const PositionBlock> blocks, usize batchPositions)
+                    {
+                        step++;
+                        if constexpr (SPARSE)
+                        {
+                            // only the touched params are read by the batch,
+                            // so only they need to be current
+                            arena.markTouched(
+                                threadPool, positions, blocks, batchPositions, coefficients);
+                            packed.resize(params.totalSize());
+                            for (u32 i : arena.touched())
+                            {
+                                adamCatchUp(params[i], momentum[i], velocity[i],
+                                    step - 1 - lastStep[i], config.lr);
+                                packed[i] = {static_cast<Real>(params[i].mg),
+                                    static_cast<Real>(params[i].eg)};
+                            }
+                        }
+                        else
+                            packParams(params, packed);
 
-                velocity[i].mg = BETA2 * velocity[i].mg + (1 - BETA2) * gradient[i].mg * gradient[i].mg;
-                velocity[i].eg = BETA2 * velocity[i].eg + (1 - BETA2) * gradient[i].eg * gradient[i].eg;
+                        double batchWeight = sumBlockWeights(blocks, weights);
+                        epochError += computeGradient<Real, SPARSE>(threadPool, config, positions,
+                            weights, blocks, batchPositions, batchWeight, coefficients, kValue,
+                            packed.data(), arena, gradient, scoreKValue);
+                        epochWeight += batchWeight;
 
-                params[i].mg -= LR * momentum[i].mg / (std::sqrt(velocity[i].mg) + EPSILON);
-                params[i].eg -= LR * momentum[i].eg / (std::sqrt(velocity[i].eg) + EPSILON);
-            }
-        }
+                        if constexpr (SPARSE)
+                        {
+                            touchedTotal += arena.touched().size();
+                            for (u32 i : arena.touched())
+                            {
+                                adamUpdate(
+                                    params[i], momentum[i], velocity[i], gradient[i], config.lr);
+                                lastStep[i] = step;
+                            }
+                        }
+                        else
+                        {
+                            for (usize i = 0; i < gradient.size(); i++)
+                                adamUpdate(
+                                    params[i], momentum[i], velocity[i], gradient[i], config.lr);
+                        }
+                    });
+            });
+        double error = epochError / epochWeight;
+        std::cout << "Epoch: " << epoch << std::endl;
+        std::cout << "Error: " << error << std::endl;
+        outFile << "Epoch: " << epoch << std::endl;
+        outFile << "Error: " << error << std::endl;
         if (epoch % 10 == 0)
         {
-            double error = calcError(threadPool, dataset.positions, dataset.allCoefficients, kValue,
-                params, ErrorType::NORMAL, scoreKValue);
-            std::cout << "Epoch: " << epoch << std::endl;
-            std::cout << "Error: " << error << std::endl;
-            outFile << "Epoch: " << epoch << std::endl;
-            outFile << "Error: " << error << std::endl;
+            if constexpr (SPARSE)
+            {
+                catchUpAll();
+                std::cout << "Avg touched params per batch: "
+                          << static_cast<double>(touchedTotal) / step << " / " << params.totalSize()
+                          << std::endl;
+            }
+            if (DatasetStream* stream = data.stream())
+            {
+                std::cout << "Stream: " << stream->bytesRead() / (1024 * 1024) << " MiB read, "
+                          << stream->stallSeconds() << "s waiting for reads" << std::endl;
+            }
+            if constexpr (MIXED_PRECISION)
+            {
+                // keep an eye on how far the single precision path drifts, at the current
+                // params rather than the running error of the epoch
+                evalCache.evaluate(threadPool, data, params);
+                double singleError = evalCache.error(threadPool, data, kValue, ErrorType::NORMAL);
+                double doubleError = calcError<double>(
+                    threadPool, config, data, kValue, params, ErrorType::NORMAL, scoreKValue);
+                std::cout << "Error (single): " << singleError << " Error (double): "
+                          << doubleError << " Diff: " << singleError - doubleError << std::endl;
+                outFile << "Error (single): " << singleError << " Error (double): " << doubleError
+                        << " Diff: " << singleError - doubleError << std::endl;
+            }
 
             auto t2 = std::chrono::steady_clock::now();
             auto totalTime =
@@ -352,8 +712,287 @@ EvalParams tune(const Dataset& dataset, std::ofstream& outFile)
             outFile << std::endl;
         }
     }
-    double finalKValue = findKValue(threadPool, dataset.positions, dataset.allCoefficients, params,
-        ErrorType::EVAL_WDL, scoreKValue);
+    if constexpr (SPARSE)
+        catchUpAll();
+}
+
+// l-bfgs works on the mg and eg of every param as one flat vector
+void flattenParams(const EvalParams& params, std::vector<double>& flat)
+{
+    flat.resize(params.totalSize() * 2);
+    for (usize i = 0; i < params.totalSize(); i++)
+    {
+        flat[2 * i] = params[i].mg;
+        flat[2 * i + 1] = params[i].eg;
+    }
+}
+
+void unflattenParams(const std::vector<double>& flat, EvalParams& params)
+{
+    for (usize i = 0; i < params.totalSize(); i++)
+    {
+        params[i].mg = flat[2 * i];
+        params[i].eg = flat[2 * i + 1];
+    }
+}
+
+double dot(const std::vector<double>& a, const std::vector<double>& b)
+{
+    double sum = 0.0;
+    for (usize i = 0; i < a.size(); i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+// gradient over the whole dataset, scaled like computeGradient's, flattened into gradient
+// returns the error of the params
+template<typename Real>
+double calcFullGradient(ThreadPool& threadPool, const TuneConfig& config, TuneData& data,
+    BatchScheduler& scheduler, const EvalParams& params, GradientArena<Real>& arena,
+    double kValue, double scoreKValue, std::vector<double>& gradient)
+{
+    std::vector<PackedParam<Real>> packed;
+    packParams(params, packed);
+    std::vector<Gradient> batchGradient(params.totalSize(), {0, 0});
+    gradient.assign(params.totalSize() * 2, 0.0);
+
+    // the batches only split up the work, their gradients are summed by weight
+    double error = 0.0;
+    data.forEachChunk(
+        [&](std::span<const Position> positions, std::span<const float> weights,
+            Coeffs coefficients)
+        {
+            scheduler.forEachBatch(positions.size(),
+                [&](std::span<const PositionBlock> blocks, usize batchPositions)
+                {
+                    double batchWeight = sumBlockWeights(blocks, weights);
+                    error += computeGradient<Real, false>(threadPool, config, positions, weights,
+                        blocks, batchPositions, batchWeight, coefficients, kValue, packed.data(),
+                        arena, batchGradient, scoreKValue);
+                    for (usize i = 0; i < params.totalSize(); i++)
+                    {
+                        gradient[2 * i] += batchGradient[i].mg * batchWeight;
+                        gradient[2 * i + 1] += batchGradient[i].eg * batchWeight;
+                    }
+                });
+        });
+    for (double& grad : gradient)
+        grad /= data.totalWeight();
+    return error / data.totalWeight();
+}
+
+// full dataset l-bfgs. the loss is smooth and the features are sparse and linear, so it
+// converges in far fewer passes over the data than minibatch adam takes epochs.
+// the gradient is half the gradient of the error, so the line search minimizes half the
+// error, with trial points evaluated through the eval cache, which is cheaper than a
+// gradient pass. the cache keeps float evals, so the line search and the convergence test
+// compare errors that all come from it, never against the error of a gradient pass
+template<typename Real>
+void runLbfgs(ThreadPool& threadPool, const TuneConfig& config, TuneData& data,
+    EvalCache<Real>& evalCache, EvalParams& params, double kValue, double scoreKValue,
+    std::ofstream& outFile)
+{
+    constexpr usize HISTORY = 10;
+    // sufficient decrease constant of the armijo condition
+    constexpr double ARMIJO = 1e-4;
+    constexpr i32 MAX_LINE_SEARCH_STEPS = 20;
+    // stop once an iteration improves the error by less than this fraction of it
+    constexpr double TOLERANCE = 1e-9;
+
+    BatchScheduler scheduler(config.batchSize, threadPool.concurrency(), false, false);
+    GradientArena<Real> arena(threadPool.concurrency(), params.totalSize());
+    auto startTime = std::chrono::steady_clock::now();
+    u32 gradientPasses = 0;
+    u32 evalPasses = 0;
+
+    std::vector<double> x, gradient;
+    flattenParams(params, x);
+    double error = calcFullGradient(
+        threadPool, config, data, scheduler, params, arena, kValue, scoreKValue, gradient);
+    gradientPasses++;
+    evalCache.evaluate(threadPool, data, params);
+    double cacheError = evalCache.error(threadPool, data, kValue, ErrorType::NORMAL);
+    evalPasses++;
+
+    // the last HISTORY steps and gradient changes, oldest first
+    std::deque<std::vector<double>> steps, gradientChanges;
+    std::deque<double> rhos;
+    std::vector<double> direction(x.size()), alphas(HISTORY), trialX(x.size());
+    EvalParams trialParams = params;
+    i32 iterations = 0;
+    for (i32 iteration = 1; iteration <= config.maxEpochs; iteration++)
+    {
+        // two loop recursion, direction = -H * gradient
+        for (usize i = 0; i < x.size(); i++)
+            direction[i] = -gradient[i];
+        for (usize j = steps.size(); j-- > 0;)
+        {
+            alphas[j] = rhos[j] * dot(steps[j], direction);
+            for (usize i = 0; i < x.size(); i++)
+                direction[i] -= alphas[j] * gradientChanges[j][i];
+        }
+        // the initial hessian is a scaled identity. without any history, the first step
+        // moves the param with the largest gradient by 1
+        double gamma;
+        if (steps.empty())
+        {
+            double maxGradient = 0.0;
+            for (double grad : gradient)
+                maxGradient = std::max(maxGradient, std::abs(grad));
+            gamma = maxGradient > 0 ? 1.0 / maxGradient : 1.0;
+        }
+        else
+            gamma = dot(steps.back(), gradientChanges.back())
+                / dot(gradientChanges.back(), gradientChanges.back());
+        for (double& dir : direction)
+            dir *= gamma;
+        for (usize j = 0; j < steps.size(); j++)
+        {
+            double beta = rhos[j] * dot(gradientChanges[j], direction);
+            for (usize i = 0; i < x.size(); i++)
+                direction[i] += steps[j][i] * (alphas[j] - beta);
+        }
+
+        double slope = dot(gradient, direction);
+        if (slope >= 0)
+        {
+            std::cout << "L-BFGS direction is not a descent direction, stopping" << std::endl;
+            break;
+        }
+
+        // backtracking line search on half the error
+        double stepSize = 1.0;
+        double trialError = 0.0;
+        bool accepted = false;
+        for (i32 i = 0; i < MAX_LINE_SEARCH_STEPS; i++)
+        {
+            for (usize j = 0; j < x.size(); j++)
+                trialX[j] = x[j] + stepSize * direction[j];
+            unflattenParams(trialX, trialParams);
+            evalCache.evaluate(threadPool, data, trialParams);
+            trialError = evalCache.error(threadPool, data, kValue, ErrorType::NORMAL);
+            evalPasses++;
+            if (trialError / 2 <= cacheError / 2 + ARMIJO * stepSize * slope)
+            {
+                accepted = true;
+                break;
+            }
+            stepSize *= 0.5;
+        }
+        if (!accepted)
+        {
+            std::cout << "L-BFGS line search failed, stopping" << std::endl;
+            break;
+        }
+
+        double previousError = cacheError;
+        cacheError = trialError;
+        std::vector<double> newGradient;
+        error = calcFullGradient(threadPool, config, data, scheduler, trialParams, arena, kValue,
+            scoreKValue, newGradient);
+        gradientPasses++;
+
+        std::vector<double> step(x.size()), gradientChange(x.size());
+        for (usize i = 0; i < x.size(); i++)
+        {
+            step[i] = trialX[i] - x[i];
+            gradientChange[i] = newGradient[i] - gradient[i];
+        }
+        double curvature = dot(step, gradientChange);
+        // skip updates that would make the hessian estimate indefinite
+        if (curvature > 1e-12 * dot(gradientChange, gradientChange))
+        {
+            if (steps.size() == HISTORY)
+            {
+                steps.pop_front();
+                gradientChanges.pop_front();
+                rhos.pop_front();
+            }
+            steps.push_back(std::move(step));
+            gradientChanges.push_back(std::move(gradientChange));
+            rhos.push_back(1.0 / curvature);
+        }
+
+        iterations = iteration;
+        x = trialX;
+        params = trialParams;
+        gradient = std::move(newGradient);
+
+        double totalTime = std::chrono::duration_cast<std::chrono::duration<double>>(
+            std::chrono::steady_clock::now() - startTime).count();
+        std::cout << "Iteration: " << iteration << " Error: " << error << " Step: " << stepSize
+                  << " Passes: " << gradientPasses + evalPasses << " Time: " << totalTime << "s"
+                  << std::endl;
+        outFile << "Iteration: " << iteration << " Error: " << error << " Step: " << stepSize
+                << " Passes: " << gradientPasses + evalPasses << " Time: " << totalTime << "s"
+                << std::endl;
+        if (iteration % 10 == 0)
+        {
+            EvalFn::printEvalParams(params, std::cout);
+            std::cout << std::endl;
+            EvalFn::printEvalParamsExtracted(params, outFile);
+            outFile << std::endl;
+        }
+        if (previousError - cacheError < TOLERANCE * previousError)
+        {
+            std::cout << "L-BFGS converged" << std::endl;
+            break;
+        }
+    }
+    std::cout << "L-BFGS took " << iterations << " iterations, "
+              << gradientPasses << " gradient passes and " << evalPasses << " eval passes"
+              << std::endl;
+    outFile << "L-BFGS took " << iterations << " iterations, "
+            << gradientPasses << " gradient passes and " << evalPasses << " eval passes"
+            << std::endl;
+}
+
+// the precision and sparse mode are template params so the batch loop is specialized for them
+template<typename Real, bool SPARSE>
+EvalParams tuneImpl(
+    ThreadPool& threadPool, const TuneConfig& config, TuneData& data, std::ofstream& outFile)
+{
+    constexpr bool MIXED_PRECISION = !std::is_same_v<Real, double>;
+
+    EvalParams params = EvalFn::getInitialParams();
+    auto kSearchStart = std::chrono::steady_clock::now();
+    EvalCache<Real> evalCache(config, data);
+    double scoreKValue = findKValue(threadPool, data, evalCache, ErrorType::SCORE_WDL);
+    evalCache.setScoreKValue(scoreKValue);
+    evalCache.evaluate(threadPool, data, EvalFn::getKParams());
+    double originalKValue = findKValue(threadPool, data, evalCache, ErrorType::EVAL_WDL);
+    double kValue = config.kValue <= 0
+        ? findKValue(threadPool, data, evalCache, ErrorType::NORMAL)
+        : config.kValue;
+    std::cout << "K search took "
+              << std::chrono::duration_cast<std::chrono::duration<double>>(
+                     std::chrono::steady_clock::now() - kSearchStart)
+                     .count()
+              << "s" << std::endl;
+
+    std::cout << "Using " << bestKernels<Real>().name << " kernels ("
+              << (MIXED_PRECISION ? "single" : "double") << " precision)" << std::endl;
+    std::cout << "Final normal k value: " << kValue << std::endl;
+    std::cout << "Final wdl k value: " << originalKValue << std::endl;
+    std::cout << "Final score k value: " << scoreKValue << std::endl;
+    outFile << "Final k value: " << kValue << std::endl;
+    outFile << "Final wdl k value: " << originalKValue << std::endl;
+    outFile << "Final score k value: " << scoreKValue << std::endl;
+
+    if (config.init == TuneInit::ZERO)
+        for (auto& param : params.linear)
+            param.mg = param.eg = 0;
+    else if (config.init == TuneInit::MATERIAL)
+        params = EvalFn::getMaterialParams();
+
+    if (config.optimizer == TuneOptimizer::LBFGS)
+        runLbfgs(threadPool, config, data, evalCache, params, kValue, scoreKValue, outFile);
+    else
+        runAdam<Real, SPARSE>(
+            threadPool, config, data, evalCache, params, kValue, scoreKValue, outFile);
+
+    evalCache.evaluate(threadPool, data, params);
+    double finalKValue = findKValue(threadPool, data, evalCache, ErrorType::EVAL_WDL);
     std::cout << "WDL k value for tuned params: " << finalKValue << std::endl;
     std::cout << "Renormalizing eval scale\n" << std::endl;
     outFile << "WDL k value for tuned params: " << finalKValue << std::endl;
@@ -368,3 +1007,86 @@ EvalParams tune(const Dataset& dataset, std::ofstream& outFile)
 
     return params;
 }
+
+void placeDataset(ThreadPool& threadPool, const TuneConfig& config, Dataset& dataset)
+{
+    Dataset placed;
+    placed.positions.resize(dataset.positions.size());
+    placed.allCoefficients.resize(dataset.allCoefficients.size());
+    placed.weights.resize(dataset.weights.size());
+
+    // coefficient offsets never decrease between positions, so the ranges between the
+    // first positions of the slices split up the coefficients. with deduplication,
+    // coefficients shared across a slice boundary go to the later slice
+    std::vector<usize> threadBytes(threadPool.concurrency(), 0);
+    threadPool.run(
+        [&](u32 threadID)
+        {
+            forEachThreadSlice(threadID, threadPool.concurrency(), dataset.positions.size(),
+                config.batchSize, [&](usize begin, usize end)
+                {
+                    if (begin == end)
+                        return;
+                    usize coeffBegin = dataset.positions[begin].coeffBegin;
+                    usize coeffEnd = end < dataset.positions.size()
+                        ? dataset.positions[end].coeffBegin
+                        : dataset.allCoefficients.size();
+                    std::copy(dataset.positions.begin() + begin, dataset.positions.begin() + end,
+                        placed.positions.begin() + begin);
+                    if (!dataset.weights.empty())
+                        std::copy(dataset.weights.begin() + begin, dataset.weights.begin() + end,
+                            placed.weights.begin() + begin);
+                    std::copy(dataset.allCoefficients.begin() + coeffBegin,
+                        dataset.allCoefficients.begin() + coeffEnd,
+                        placed.allCoefficients.begin() + coeffBegin);
+                    threadBytes[threadID] += (end - begin) * sizeof(Position)
+                        + (coeffEnd - coeffBegin) * sizeof(Coefficient);
+                });
+        });
+    dataset = std::move(placed);
+
+    std::cout << "Dataset placement:";
+    for (u32 threadID = 0; threadID < threadPool.concurrency(); threadID++)
+        std::cout << " t" << threadID << "(node" << threadPool.threadNode(threadID)
+                  << ")=" << threadBytes[threadID] / (1024 * 1024) << "MiB";
+    std::cout << std::endl;
+}
+
+template<typename Real>
+EvalParams tuneWithPrecision(
+    ThreadPool& threadPool, const TuneConfig& config, TuneData& data, std::ofstream& outFile)
+{
+    if (config.sparse)
+        return tuneImpl<Real, true>(threadPool, config, data, outFile);
+    return tuneImpl<Real, false>(threadPool, config, data, outFile);
+}
+
+EvalParams tuneData(
+    ThreadPool& threadPool, const TuneConfig& config, TuneData& data, std::ofstream& outFile)
+{
+    // the errors are averaged over the positions
+    if (data.size() == 0)
+    {
+        std::cout << "Error: Dataset has no positions to tune on" << std::endl;
+        exit(1);
+    }
+    if (config.singlePrecision)
+        return tuneWithPrecision<float>(threadPool, config, data, outFile);
+    return tuneWithPrecision<double>(threadPool, config, data, outFile);
+}
+
+EvalParams tune(ThreadPool& threadPool, const TuneConfig& config, const Dataset& dataset,
+    std::ofstream& outFile)
+{
+    TuneData data(dataset.positions, dataset.weights, dataset.allCoefficients);
+    return tuneData(threadPool, config, data, outFile);
+}
+
+EvalParams tuneStreamed(ThreadPool& threadPool, const TuneConfig& config,
+    const std::string& cachePath, std::ofstream& outFile)
+{
+    DatasetStream stream(
+        cachePath, config.batchSize, static_cast<usize>(config.memoryBudgetMB) * 1024 * 1024);
+    TuneData data(stream);
+    return tuneData(threadPool, config, data, outFile);
+}
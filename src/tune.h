@@ -4,8 +4,10 @@
 #include <cmath>
 #include <span>
 #include <fstream>
+#include <string>
 #include <array>
 #include "dataset.h"
+#include "tune_config.h"
 #include "thread_pool.h"
 
 enum class ParamType
@@ -22,12 +24,15 @@ struct EvalParam
     double eg;
 };
 // hack lol
-struct Gradient
+template<typename Real>
+struct BasicGradient
 {
-    double mg;
-    double eg;
+    Real mg;
+    Real eg;
 };
 
+using Gradient = BasicGradient<double>;
+
 using Coeffs = std::span<const Coefficient>;
 struct EvalParams
 {
@@ -49,4 +54,60 @@ struct EvalParams
     std::vector<EvalParam> linear;
 };
 
-EvalParams tune(const Dataset& dataset, std::ofstream& outFile);
+// calls fn(begin, end) for each range of positions the thread works on while tuning,
+// which is its share of every batch. the positions that don't fill a whole batch belong to
+// the last one, like the batches of the tuner. computeGradient and calcError both split the
+// work like this, so with pinned threads the memory each one first touched stays local to it
+template<typename Fn>
+void forEachThreadSlice(
+    u32 threadID, u32 concurrency, usize numPositions, usize batchSize, Fn&& fn)
+{
+    usize numBatches = numPositions / batchSize;
+    if (numBatches == 0 && numPositions > 0)
+        numBatches = 1;
+    for (usize batch = 0; batch < numBatches; batch++)
+    {
+        usize batchBegin = batch * batchSize;
+        usize size = batch + 1 < numBatches ? batchSize : numPositions - batchBegin;
+        fn(batchBegin + size * threadID / concurrency,
+            batchBegin + size * (threadID + 1) / concurrency);
+    }
+}
+
+// consecutive positions of a chunk that a batch takes as a whole
+struct PositionBlock
+{
+    usize begin;
+    usize end;
+};
+
+// calls fn(begin, end) for each part of the blocks of a batch that is in the thread's share
+// of its numPositions positions. the shares are even like parallelFor's, and the same
+// ranges when the batch is a single block
+template<typename Fn>
+void forEachBlockSlice(u32 threadID, u32 concurrency, std::span<const PositionBlock> blocks,
+    usize numPositions, Fn&& fn)
+{
+    usize sliceBegin = numPositions * threadID / concurrency;
+    usize sliceEnd = numPositions * (threadID + 1) / concurrency;
+    usize offset = 0;
+    for (const PositionBlock& block : blocks)
+    {
+        if (offset >= sliceEnd)
+            break;
+        usize size = block.end - block.begin;
+        usize begin = std::max(sliceBegin, offset);
+        usize end = std::min(sliceEnd, offset + size);
+        if (begin < end)
+            fn(block.begin + begin - offset, block.begin + end - offset);
+        offset += size;
+    }
+}
+
+// copies the dataset into new memory that is first touched by the threads that use it
+void placeDataset(ThreadPool& threadPool, const TuneConfig& config, Dataset& dataset);
+EvalParams tune(ThreadPool& threadPool, const TuneConfig& config, const Dataset& dataset,
+    std::ofstream& outFile);
+// tunes on a dataset cache that is read in chunks of at most config.memoryBudgetMB
+EvalParams tuneStreamed(ThreadPool& threadPool, const TuneConfig& config,
+    const std::string& cachePath, std::ofstream& outFile);
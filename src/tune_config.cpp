@@ -0,0 +1,331 @@
+#include "tune_config.h"
+#include "qsearch.h"
+
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+
+[[noreturn]] void invalidValue(const std::string& key, const std::string& value)
+{
+    std::cout << "Error: Invalid value for " << key << ": " << value << std::endl;
+    exit(1);
+}
+
+template<typename T>
+T parseNumber(const std::string& key, const std::string& value)
+{
+    T result = {};
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc() || ptr != value.data() + value.size())
+        invalidValue(key, value);
+    return result;
+}
+
+bool parseBool(const std::string& key, const std::string& value)
+{
+    if (value == "true" || value == "1" || value == "on")
+        return true;
+    if (value == "false" || value == "0" || value == "off")
+        return false;
+    invalidValue(key, value);
+}
+
+std::string trim(const std::string& str)
+{
+    size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return "";
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+const char* initName(TuneInit init)
+{
+    switch (init)
+    {
+        case TuneInit::ZERO:
+            return "zero";
+        case TuneInit::MATERIAL:
+            return "material";
+        default:
+            return "default";
+    }
+}
+
+const char* optimizerName(TuneOptimizer optimizer)
+{
+    switch (optimizer)
+    {
+        case TuneOptimizer::LBFGS:
+            return "lbfgs";
+        default:
+            return "adam";
+    }
+}
+
+const char* dataFormatName(DatasetFormat format)
+{
+    switch (format)
+    {
+        case DatasetFormat::MARLINFORMAT:
+            return "marlinformat";
+        case DatasetFormat::BULLETFORMAT:
+            return "bulletformat";
+        default:
+            return "text";
+    }
+}
+
+}
+
+u32 resolveThreads(const TuneConfig& config)
+{
+    if (config.threads > 0)
+        return config.threads;
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+DatasetLoadOptions datasetLoadOptions(const TuneConfig& config)
+{
+    DatasetLoadOptions options;
+    options.dedup = config.dedup;
+    options.validateFens = config.validateFens;
+    options.skipInCheck = config.skipInCheck;
+    options.skipNoisy = config.skipNoisy;
+    options.maxScore = config.maxScore;
+    options.minPly = config.minPly;
+    options.sampleSize = config.sampleSize;
+    options.resolvePly = config.resolvePly;
+    options.format = config.dataFormat;
+    return options;
+}
+
+void setConfigOption(TuneConfig& config, const std::string& key, const std::string& value)
+{
+    if (key == "threads")
+        config.threads = value == "auto" ? 0 : parseNumber<u32>(key, value);
+    else if (key == "epochs")
+    {
+        config.maxEpochs = parseNumber<i32>(key, value);
+        if (config.maxEpochs <= 0)
+            invalidValue(key, value);
+    }
+    else if (key == "batch-size")
+    {
+        config.batchSize = parseNumber<i32>(key, value);
+        if (config.batchSize <= 0)
+            invalidValue(key, value);
+    }
+    else if (key == "wdl-lambda")
+    {
+        config.wdlLambda = parseNumber<double>(key, value);
+        if (config.wdlLambda < 0 || config.wdlLambda > 1)
+            invalidValue(key, value);
+    }
+    else if (key == "lr")
+        config.lr = parseNumber<double>(key, value);
+    else if (key == "k")
+        config.kValue = value == "auto" ? 0.0 : parseNumber<double>(key, value);
+    else if (key == "init")
+    {
+        if (value == "zero")
+            config.init = TuneInit::ZERO;
+        else if (value == "material")
+            config.init = TuneInit::MATERIAL;
+        else if (value == "default")
+            config.init = TuneInit::DEFAULT;
+        else
+            invalidValue(key, value);
+    }
+    else if (key == "optimizer")
+    {
+        if (value == "adam")
+            config.optimizer = TuneOptimizer::ADAM;
+        else if (value == "lbfgs")
+            config.optimizer = TuneOptimizer::LBFGS;
+        else
+            invalidValue(key, value);
+    }
+    else if (key == "precision")
+    {
+        if (value != "single" && value != "double")
+            invalidValue(key, value);
+        config.singlePrecision = value == "single";
+    }
+    else if (key == "sparse")
+        config.sparse = parseBool(key, value);
+    else if (key == "shuffle")
+        config.shuffle = parseBool(key, value);
+    else if (key == "pin-threads")
+        config.pinThreads = parseBool(key, value);
+    else if (key == "memory-budget")
+        config.memoryBudgetMB = parseNumber<u32>(key, value);
+    else if (key == "dedup")
+        config.dedup = parseBool(key, value);
+    else if (key == "validate-fens")
+        config.validateFens = parseBool(key, value);
+    else if (key == "skip-in-check")
+        config.skipInCheck = parseBool(key, value);
+    else if (key == "skip-noisy")
+        config.skipNoisy = parseBool(key, value);
+    else if (key == "max-score")
+        config.maxScore = parseNumber<i32>(key, value);
+    else if (key == "min-ply")
+        config.minPly = parseNumber<i32>(key, value);
+    else if (key == "sample-size")
+        config.sampleSize = parseNumber<u64>(key, value);
+    else if (key == "resolve-ply")
+    {
+        config.resolvePly = parseNumber<i32>(key, value);
+        if (config.resolvePly < 0 || config.resolvePly > MAX_RESOLVE_PLY)
+            invalidValue(key, value);
+    }
+    else if (key == "data-format")
+    {
+        if (value == "text")
+            config.dataFormat = DatasetFormat::TEXT;
+        else if (value == "marlinformat")
+            config.dataFormat = DatasetFormat::MARLINFORMAT;
+        else if (value == "bulletformat")
+            config.dataFormat = DatasetFormat::BULLETFORMAT;
+        else
+            invalidValue(key, value);
+    }
+    else
+    {
+        std::cout << "Error: Unknown option: " << key << std::endl;
+        exit(1);
+    }
+}
+
+void loadConfigFile(TuneConfig& config, const std::string& filepath)
+{
+    std::ifstream file(filepath);
+    if (!file)
+    {
+        std::cout << "Error: Could not open config file: " << filepath << std::endl;
+        exit(1);
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        size_t equals = line.find('=');
+        if (equals == std::string::npos)
+        {
+            std::cout << "Error: Expected key=value in config file: " << line << std::endl;
+            exit(1);
+        }
+        setConfigOption(config, trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+    }
+}
+
+std::vector<std::string> parseCommandLine(TuneConfig& config, int argc, char** argv)
+{
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0)
+        {
+            positional.push_back(arg);
+            continue;
+        }
+
+        std::string key = arg.substr(2);
+        std::string value;
+        size_t equals = key.find('=');
+        if (equals != std::string::npos)
+        {
+            value = key.substr(equals + 1);
+            key = key.substr(0, equals);
+        }
+        else if (i + 1 < argc)
+            value = argv[++i];
+        else
+        {
+            std::cout << "Error: Missing value for option: " << key << std::endl;
+            exit(1);
+        }
+
+        if (key == "config")
+            loadConfigFile(config, value);
+        else
+            setConfigOption(config, key, value);
+    }
+    // the optimizer can be given after the epochs
+    if (config.optimizer == TuneOptimizer::ADAM && config.maxEpochs % 100 != 0)
+    {
+        std::cout << "Error: epochs must be divisible by 100 with the adam optimizer" << std::endl;
+        exit(1);
+    }
+    return positional;
+}
+
+void rejectLoadOptions(const TuneConfig& config)
+{
+    const TuneConfig defaults;
+    std::vector<const char*> set;
+    if (config.dedup != defaults.dedup)
+        set.push_back("dedup");
+    if (config.validateFens != defaults.validateFens)
+        set.push_back("validate-fens");
+    if (config.skipInCheck != defaults.skipInCheck)
+        set.push_back("skip-in-check");
+    if (config.skipNoisy != defaults.skipNoisy)
+        set.push_back("skip-noisy");
+    if (config.maxScore != defaults.maxScore)
+        set.push_back("max-score");
+    if (config.minPly != defaults.minPly)
+        set.push_back("min-ply");
+    if (config.sampleSize != defaults.sampleSize)
+        set.push_back("sample-size");
+    if (config.resolvePly != defaults.resolvePly)
+        set.push_back("resolve-ply");
+    if (config.dataFormat != defaults.dataFormat)
+        set.push_back("data-format");
+    if (set.empty())
+        return;
+
+    std::cout << "Error: A dataset cache was already loaded with its options, these only apply "
+                 "when extracting it:";
+    for (const char* name : set)
+        std::cout << ' ' << name;
+    std::cout << std::endl;
+    exit(1);
+}
+
+void printConfig(const TuneConfig& config, std::ostream& os)
+{
+    os << "Config:";
+    os << " threads=" << resolveThreads(config) << (config.threads == 0 ? " (auto)" : "");
+    os << " epochs=" << config.maxEpochs;
+    os << " batch-size=" << config.batchSize;
+    os << " wdl-lambda=" << config.wdlLambda;
+    os << " lr=" << config.lr;
+    os << " k=" << (config.kValue <= 0 ? "auto" : std::to_string(config.kValue));
+    os << " init=" << initName(config.init);
+    os << " optimizer=" << optimizerName(config.optimizer);
+    os << " precision=" << (config.singlePrecision ? "single" : "double");
+    os << " sparse=" << (config.sparse ? "true" : "false");
+    os << " shuffle=" << (config.shuffle ? "true" : "false");
+    os << " pin-threads=" << (config.pinThreads ? "true" : "false");
+    os << " memory-budget=" << config.memoryBudgetMB << "MB";
+    os << " dedup=" << (config.dedup ? "true" : "false");
+    os << " validate-fens=" << (config.validateFens ? "true" : "false");
+    os << " skip-in-check=" << (config.skipInCheck ? "true" : "false");
+    os << " skip-noisy=" << (config.skipNoisy ? "true" : "false");
+    os << " max-score=" << config.maxScore;
+    os << " min-ply=" << config.minPly;
+    os << " sample-size=" << config.sampleSize;
+    os << " resolve-ply=" << config.resolvePly;
+    os << " data-format=" << dataFormatName(config.dataFormat);
+    os << std::endl;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "sirius/defs.h"
+#include "dataset.h"
+#include "settings.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class TuneInit
+{
+    DEFAULT,
+    ZERO,
+    MATERIAL
+};
+
+enum class TuneOptimizer
+{
+    ADAM,
+    LBFGS
+};
+
+// tuning options that can be changed without recompiling
+// the defaults come from settings.h
+struct TuneConfig
+{
+    u32 threads = TUNE_THREADS;
+    i32 maxEpochs = TUNE_MAX_EPOCHS;
+    i32 batchSize = BATCH_SIZE;
+    double wdlLambda = WDL_LAMBDA;
+    double lr = TUNE_LR;
+    // searched for if <= 0
+    double kValue = TUNE_K;
+    TuneInit init = TUNE_FROM_ZERO ? TuneInit::ZERO
+        : TUNE_FROM_MATERIAL       ? TuneInit::MATERIAL
+                                   : TuneInit::DEFAULT;
+    TuneOptimizer optimizer = TUNE_LBFGS ? TuneOptimizer::LBFGS : TuneOptimizer::ADAM;
+    bool singlePrecision = TUNE_SINGLE_PRECISION;
+    bool sparse = TUNE_SPARSE;
+    bool shuffle = TUNE_SHUFFLE;
+    bool pinThreads = TUNE_PIN_THREADS;
+    // 0 loads the whole dataset into memory
+    u32 memoryBudgetMB = TUNE_MEMORY_BUDGET_MB;
+    bool dedup = TUNE_DEDUP;
+    bool validateFens = TUNE_VALIDATE_FENS;
+    bool skipInCheck = TUNE_SKIP_IN_CHECK;
+    bool skipNoisy = TUNE_SKIP_NOISY;
+    i32 maxScore = TUNE_MAX_SCORE;
+    i32 minPly = TUNE_MIN_PLY;
+    u64 sampleSize = TUNE_SAMPLE_SIZE;
+    i32 resolvePly = TUNE_RESOLVE_PLY;
+    // format of datasets that aren't caches
+    DatasetFormat dataFormat = DatasetFormat::TEXT;
+};
+
+// threads = 0 means one per hardware thread
+u32 resolveThreads(const TuneConfig& config);
+DatasetLoadOptions datasetLoadOptions(const TuneConfig& config);
+
+// all of these exit with an error on unknown options or invalid values
+void setConfigOption(TuneConfig& config, const std::string& key, const std::string& value);
+// one key=value per line, # starts a comment
+void loadConfigFile(TuneConfig& config, const std::string& filepath);
+// applies --key=value and --config=<file> options in order, returns the other arguments
+std::vector<std::string> parseCommandLine(TuneConfig& config, int argc, char** argv);
+// exits with an error if any option that only applies while loading a dataset is set,
+// for datasets that are caches
+void rejectLoadOptions(const TuneConfig& config);
+
+void printConfig(const TuneConfig& config, std::ostream& os);
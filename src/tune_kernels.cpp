@@ -0,0 +1,130 @@
+#include "tune_kernels.h"
+
+namespace
+{
+
+struct EvalTrace
+{
+    struct TraceElem
+    {
+        double mg;
+        double eg;
+    };
+    TraceElem normal;
+    ColorArray<TraceElem> rawSafety;
+    TraceElem nonComplexity;
+    TraceElem complexity;
+};
+
+template<typename Real>
+double evaluate(const Position& pos, Coeffs coefficients, const PackedParam<Real>* params,
+    EvalTrace& trace)
+{
+    const Coefficient* coeff = coefficients.data() + pos.coeffBegin;
+    for (i32 i = 0; i < pos.normalCount; i++, coeff++)
+    {
+        const PackedParam<Real>& param = params[coeff->index];
+        trace.normal.mg += param.mg * coeff->value;
+        trace.normal.eg += param.eg * coeff->value;
+    }
+    for (Color color : {Color::WHITE, Color::BLACK})
+    {
+        for (i32 i = 0; i < pos.safetyCount[color]; i++, coeff++)
+        {
+            const PackedParam<Real>& param = params[coeff->index];
+            trace.rawSafety[color].mg += param.mg * coeff->value;
+            trace.rawSafety[color].eg += param.eg * coeff->value;
+        }
+    }
+    // complexity has no white/black separation, only white part is used
+    for (i32 i = 0; i < pos.complexityCount; i++, coeff++)
+        trace.complexity.eg += params[coeff->index].eg * coeff->value;
+
+    double mg = 0, eg = 0;
+    mg += trace.normal.mg;
+    eg += trace.normal.eg;
+    mg += safetyFnMg(trace.rawSafety[Color::WHITE].mg);
+    mg -= safetyFnMg(trace.rawSafety[Color::BLACK].mg);
+    eg += safetyFnEg(trace.rawSafety[Color::WHITE].eg);
+    eg -= safetyFnEg(trace.rawSafety[Color::BLACK].eg);
+    trace.nonComplexity.mg = mg;
+    trace.nonComplexity.eg = eg;
+    eg += ((eg > 0) - (eg < 0)) * std::max(-std::abs(eg), trace.complexity.eg);
+
+    return (mg * pos.phase() + eg * (1.0 - pos.phase()));
+}
+
+// returns the weighted squared error of the position
+template<typename Real>
+double updateGradient(const Position& pos, double weight, Coeffs coefficients,
+    const PackedParam<Real>* params, const GradientArgs& args, BasicGradient<Real>* gradients)
+{
+    EvalTrace trace = {};
+    double eval = evaluate(pos, coefficients, params, trace);
+    double wdl = sigmoid(eval, args.kValue);
+    double target = trainingTarget(pos, args.wdlLambda, args.scoreKValue);
+    double gradientBase = (wdl - target) * (wdl * (1 - wdl)) * weight;
+    double mgBase = gradientBase * pos.phase();
+    double egBase = (gradientBase - mgBase) * pos.egScale();
+    bool mgActive = trace.complexity.mg >= -std::abs(trace.nonComplexity.mg);
+    bool egActive = trace.complexity.eg >= -std::abs(trace.nonComplexity.eg);
+    Real normalMg = static_cast<Real>(mgActive ? mgBase : 0.0);
+    Real normalEg = static_cast<Real>(egActive ? egBase : 0.0);
+
+    const Coefficient* coeff = coefficients.data() + pos.coeffBegin;
+    for (i32 i = 0; i < pos.normalCount; i++, coeff++)
+    {
+        gradients[coeff->index].mg += coeff->value * normalMg;
+        gradients[coeff->index].eg += coeff->value * normalEg;
+    }
+    for (Color color : {Color::WHITE, Color::BLACK})
+    {
+        double sign = color == Color::WHITE ? 1.0 : -1.0;
+        Real safetyMg = static_cast<Real>(sign * normalMg * safetyDerivMg(trace.rawSafety[color].mg));
+        Real safetyEg = static_cast<Real>(sign * normalEg * safetyDerivEg(trace.rawSafety[color].eg));
+        for (i32 i = 0; i < pos.safetyCount[color]; i++, coeff++)
+        {
+            gradients[coeff->index].mg += coeff->value * safetyMg;
+            gradients[coeff->index].eg += coeff->value * safetyEg;
+        }
+    }
+    Real complexityEg = normalEg * ((trace.normal.eg > 0) - (trace.normal.eg < 0));
+    for (i32 i = 0; i < pos.complexityCount; i++, coeff++)
+        gradients[coeff->index].eg += coeff->value * complexityEg;
+    return weight * (wdl - target) * (wdl - target);
+}
+
+template<typename Real>
+void evaluateScalar(std::span<const Position> positions, Coeffs coefficients,
+    const PackedParam<Real>* params, double* evals)
+{
+    for (const auto& pos : positions)
+    {
+        EvalTrace trace = {};
+        *evals++ = evaluate(pos, coefficients, params, trace);
+    }
+}
+
+template<typename Real>
+double updateGradientsScalar(std::span<const Position> positions, Coeffs coefficients,
+    const PackedParam<Real>* params, const GradientArgs& args, BasicGradient<Real>* gradients)
+{
+    double error = 0.0;
+    for (size_t i = 0; i < positions.size(); i++)
+        error += updateGradient(positions[i], args.weights ? args.weights[i] : 1.0, coefficients,
+            params, args, gradients);
+    return error;
+}
+
+}
+
+template<typename Real>
+const TuneKernels<Real>& scalarKernels()
+{
+    static constexpr TuneKernels<Real> kernels = {
+        "scalar", evaluateScalar<Real>, updateGradientsScalar<Real>};
+    return kernels;
+}
+
+template const TuneKernels<float>& scalarKernels<float>();
+template const TuneKernels<double>& scalarKernels<double>();
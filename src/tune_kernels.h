@@ -0,0 +1,96 @@
+#pragma once
+
+#include "dataset.h"
+#include "tune.h"
+
+#include <algorithm>
+#include <cmath>
+#include <span>
+
+inline double sigmoid(double x, double k)
+{
+    return 1.0 / (1 + std::exp(-x * k));
+}
+
+inline double safetyFnMg(double raw)
+{
+    return raw / 8.0 + std::max(raw, 0.0) * raw / 1024;
+}
+
+inline double safetyFnEg(double raw)
+{
+    return raw / 8.0 + std::max(raw, 0.0) * raw / 1024;
+}
+
+inline double safetyDerivMg(double raw)
+{
+    return 1.0 / 8.0 + 2.0 * std::max(raw, 0.0) / 1024;
+}
+
+inline double safetyDerivEg(double raw)
+{
+    return 1.0 / 8.0 + 2.0 * std::max(raw, 0.0) / 1024;
+}
+
+inline double trainingTarget(const Position& pos, double wdlLambda, double scoreKValue)
+{
+    return wdlLambda * pos.wdl() + (1 - wdlLambda) * sigmoid(pos.score, scoreKValue);
+}
+
+// mg/eg of a param without its type, in the precision the kernels run at
+template<typename Real>
+struct PackedParam
+{
+    Real mg;
+    Real eg;
+};
+
+template<typename Real>
+void packParams(const EvalParams& params, std::vector<PackedParam<Real>>& packed)
+{
+    packed.resize(params.totalSize());
+    for (size_t i = 0; i < params.totalSize(); i++)
+        packed[i] = {static_cast<Real>(params[i].mg), static_cast<Real>(params[i].eg)};
+}
+
+struct GradientArgs
+{
+    double kValue;
+    double scoreKValue;
+    double wdlLambda;
+    // one per position, nullptr if every position has weight 1
+    const float* weights = nullptr;
+};
+
+// writes the eval of every position to evals
+template<typename Real>
+using EvalKernel = void (*)(std::span<const Position> positions, Coeffs coefficients,
+    const PackedParam<Real>* params, double* evals);
+// adds the (unscaled) gradient of every position to gradients, and returns the weighted sum
+// of their squared errors, which falls out of the gradient for free
+template<typename Real>
+using GradientKernel = double (*)(std::span<const Position> positions,
+    Coeffs coefficients, const PackedParam<Real>* params, const GradientArgs& args,
+    BasicGradient<Real>* gradients);
+
+template<typename Real>
+struct TuneKernels
+{
+    const char* name;
+    EvalKernel<Real> evaluate;
+    GradientKernel<Real> updateGradients;
+};
+
+template<typename Real>
+const TuneKernels<Real>& scalarKernels();
+// nullptr if the cpu or the build does not support the kernels
+template<typename Real>
+const TuneKernels<Real>* avx2Kernels();
+// fastest kernels supported by the cpu
+template<typename Real>
+const TuneKernels<Real>& bestKernels()
+{
+    if (const TuneKernels<Real>* kernels = avx2Kernels<Real>())
+        return *kernels;
+    return scalarKernels<Real>();
+}
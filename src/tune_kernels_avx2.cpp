@@ -0,0 +1,449 @@
+#include "tune_kernels.h"
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#else
+#define AVX2_TARGET
+#endif
+
+// mg and eg are loaded and accumulated together as one pair
+static_assert(offsetof(PackedParam<double>, eg) == offsetof(PackedParam<double>, mg) + sizeof(double));
+static_assert(offsetof(BasicGradient<double>, eg) == offsetof(BasicGradient<double>, mg) + sizeof(double));
+static_assert(sizeof(PackedParam<float>) == 8 && offsetof(PackedParam<float>, eg) == sizeof(float));
+static_assert(sizeof(BasicGradient<float>) == 8 && offsetof(BasicGradient<float>, eg) == sizeof(float));
+
+namespace
+{
+
+// number of positions whose eval/gradient math is done together
+constexpr i32 BLOCK_SIZE = 4;
+
+struct alignas(32) EvalBlock
+{
+    double normalMg[BLOCK_SIZE];
+    double normalEg[BLOCK_SIZE];
+    double safetyMg[2][BLOCK_SIZE];
+    double safetyEg[2][BLOCK_SIZE];
+    double complexityEg[BLOCK_SIZE];
+    double phase[BLOCK_SIZE];
+};
+
+struct EvalBlockResult
+{
+    __m256d eval;
+    __m256d normalEg;
+    __m256d safetyMg[2];
+    __m256d safetyEg[2];
+    __m256d mgActive;
+    __m256d egActive;
+};
+
+AVX2_TARGET inline __m128d loadParam(const PackedParam<double>* params, i16 index)
+{
+    return _mm_loadu_pd(&params[index].mg);
+}
+
+// (mg, eg) in the low 64 bits
+AVX2_TARGET inline __m128 loadFloatPair(const void* pair)
+{
+    return _mm_castsi128_ps(_mm_loadl_epi64(static_cast<const __m128i*>(pair)));
+}
+
+AVX2_TARGET inline void storeFloatPair(void* pair, __m128 value)
+{
+    _mm_storel_epi64(static_cast<__m128i*>(pair), _mm_castps_si128(value));
+}
+
+// converts the values of the 4 coefficients at coeff to doubles, each repeated for mg and eg
+// lanes at or past remaining are zeroed, so the params and gradients of whatever
+// coefficients follow the segment are read but never changed
+AVX2_TARGET inline void loadValues(
+    const Coefficient* coeff, i32 remaining, __m256d& values01, __m256d& values23)
+{
+    static_assert(sizeof(Coefficient) == 4 && offsetof(Coefficient, value) == 2);
+    // each coefficient is one 32 bit lane, the value is the sign extended upper half
+    __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coeff));
+    __m128i mask = _mm_cmpgt_epi32(_mm_set1_epi32(remaining), _mm_setr_epi32(0, 1, 2, 3));
+    __m256d values = _mm256_cvtepi32_pd(_mm_and_si128(_mm_srai_epi32(packed, 16), mask));
+    values01 = _mm256_permute4x64_pd(values, 0b01010000);
+    values23 = _mm256_permute4x64_pd(values, 0b11111010);
+}
+
+// float version of the above, all 4 coefficients fit in one register
+AVX2_TARGET inline __m256 loadValues(const Coefficient* coeff, i32 remaining)
+{
+    __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coeff));
+    __m128i mask = _mm_cmpgt_epi32(_mm_set1_epi32(remaining), _mm_setr_epi32(0, 1, 2, 3));
+    __m128 values = _mm_cvtepi32_ps(_mm_and_si128(_mm_srai_epi32(packed, 16), mask));
+    return _mm256_set_m128(_mm_unpackhi_ps(values, values), _mm_unpacklo_ps(values, values));
+}
+
+// segments are walked in groups of 4 with the last group masked, rather than with a
+// scalar remainder loop, since segment sizes vary a lot and the remainder loop mispredicts
+struct SegmentCursor
+{
+    const Coefficient* coeff;
+    // groups may not read past this
+    const Coefficient* coeffEnd;
+};
+
+// returns the sum of (mg, eg) * value over the segment's coefficients
+AVX2_TARGET inline __m128d sumSegment(
+    SegmentCursor& cursor, i32 count, const PackedParam<double>* params)
+{
+    const Coefficient* segmentEnd = cursor.coeff + count;
+    const Coefficient* coeff = cursor.coeff;
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for (; coeff < segmentEnd && coeff + 4 <= cursor.coeffEnd; coeff += 4)
+    {
+        __m256d values01, values23;
+        loadValues(coeff, static_cast<i32>(segmentEnd - coeff), values01, values23);
+        __m256d params01 =
+            _mm256_set_m128d(loadParam(params, coeff[1].index), loadParam(params, coeff[0].index));
+        __m256d params23 =
+            _mm256_set_m128d(loadParam(params, coeff[3].index), loadParam(params, coeff[2].index));
+        acc0 = _mm256_fmadd_pd(params01, values01, acc0);
+        acc1 = _mm256_fmadd_pd(params23, values23, acc1);
+    }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    // only reached at the very end of the coefficient array
+    for (; coeff < segmentEnd; coeff++)
+        sum = _mm_fmadd_pd(loadParam(params, coeff->index), _mm_set1_pd(coeff->value), sum);
+
+    cursor.coeff = segmentEnd;
+    return sum;
+}
+
+// the sum is accumulated in float and only widened at the end
+AVX2_TARGET inline __m128d sumSegment(
+    SegmentCursor& cursor, i32 count, const PackedParam<float>* params)
+{
+    const Coefficient* segmentEnd = cursor.coeff + count;
+    const Coefficient* coeff = cursor.coeff;
+    __m256 acc = _mm256_setzero_ps();
+    for (; coeff < segmentEnd && coeff + 4 <= cursor.coeffEnd; coeff += 4)
+    {
+        __m256 values = loadValues(coeff, static_cast<i32>(segmentEnd - coeff));
+        __m128 params01 =
+            _mm_movelh_ps(loadFloatPair(&params[coeff[0].index]), loadFloatPair(&params[coeff[1].index]));
+        __m128 params23 =
+            _mm_movelh_ps(loadFloatPair(&params[coeff[2].index]), loadFloatPair(&params[coeff[3].index]));
+        acc = _mm256_fmadd_ps(_mm256_set_m128(params23, params01), values, acc);
+    }
+    __m128 halves = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    __m128d sum = _mm_cvtps_pd(_mm_add_ps(halves, _mm_movehl_ps(halves, halves)));
+    // only reached at the very end of the coefficient array
+    for (; coeff < segmentEnd; coeff++)
+        sum = _mm_fmadd_pd(
+            _mm_cvtps_pd(loadFloatPair(&params[coeff->index])), _mm_set1_pd(coeff->value), sum);
+
+    cursor.coeff = segmentEnd;
+    return sum;
+}
+
+AVX2_TARGET inline void storePair(__m128d pair, double& mg, double& eg)
+{
+    mg = _mm_cvtsd_f64(pair);
+    eg = _mm_cvtsd_f64(_mm_unpackhi_pd(pair, pair));
+}
+
+// unused lanes of a partial block are left zeroed
+template<typename Real>
+AVX2_TARGET void accumulateBlock(const Position* positions, i32 count,
+    Coeffs coefficients, const PackedParam<Real>* params, EvalBlock& block)
+{
+    block = {};
+    for (i32 lane = 0; lane < count; lane++)
+    {
+        const Position& pos = positions[lane];
+        SegmentCursor cursor = {coefficients.data() + pos.coeffBegin,
+            coefficients.data() + coefficients.size()};
+
+        __m128d normal = sumSegment(cursor, pos.normalCount, params);
+        storePair(normal, block.normalMg[lane], block.normalEg[lane]);
+        for (i32 color = 0; color < 2; color++)
+        {
+            __m128d safety = sumSegment(cursor, pos.safetyCount[color], params);
+            storePair(safety, block.safetyMg[color][lane], block.safetyEg[color][lane]);
+        }
+        __m128d complexity = sumSegment(cursor, pos.complexityCount, params);
+        block.complexityEg[lane] = _mm_cvtsd_f64(_mm_unpackhi_pd(complexity, complexity));
+
+        block.phase[lane] = pos.phase();
+    }
+}
+
+AVX2_TARGET inline __m256d safetyFn(__m256d raw)
+{
+    __m256d positive = _mm256_max_pd(raw, _mm256_setzero_pd());
+    return _mm256_fmadd_pd(_mm256_mul_pd(positive, raw), _mm256_set1_pd(1.0 / 1024),
+        _mm256_mul_pd(raw, _mm256_set1_pd(1.0 / 8.0)));
+}
+
+AVX2_TARGET inline __m256d safetyDeriv(__m256d raw)
+{
+    __m256d positive = _mm256_max_pd(raw, _mm256_setzero_pd());
+    return _mm256_fmadd_pd(positive, _mm256_set1_pd(2.0 / 1024), _mm256_set1_pd(1.0 / 8.0));
+}
+
+AVX2_TARGET inline __m256d absValue(__m256d x)
+{
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+}
+
+AVX2_TARGET inline __m256d signOf(__m256d x)
+{
+    __m256d one = _mm256_set1_pd(1.0);
+    __m256d positive = _mm256_and_pd(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ), one);
+    __m256d negative = _mm256_and_pd(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_LT_OQ), one);
+    return _mm256_sub_pd(positive, negative);
+}
+
+// same math as the scalar evaluate(), for BLOCK_SIZE positions at once
+AVX2_TARGET EvalBlockResult finishBlock(const EvalBlock& block)
+{
+    EvalBlockResult result;
+    __m256d normalMg = _mm256_load_pd(block.normalMg);
+    result.normalEg = _mm256_load_pd(block.normalEg);
+    for (i32 color = 0; color < 2; color++)
+    {
+        result.safetyMg[color] = _mm256_load_pd(block.safetyMg[color]);
+        result.safetyEg[color] = _mm256_load_pd(block.safetyEg[color]);
+    }
+
+    __m256d mg = _mm256_add_pd(normalMg,
+        _mm256_sub_pd(safetyFn(result.safetyMg[0]), safetyFn(result.safetyMg[1])));
+    __m256d eg = _mm256_add_pd(result.normalEg,
+        _mm256_sub_pd(safetyFn(result.safetyEg[0]), safetyFn(result.safetyEg[1])));
+
+    // complexity only has an eg part, the mg part is always 0
+    __m256d negAbsMg = _mm256_sub_pd(_mm256_setzero_pd(), absValue(mg));
+    __m256d negAbsEg = _mm256_sub_pd(_mm256_setzero_pd(), absValue(eg));
+    __m256d complexityEg = _mm256_load_pd(block.complexityEg);
+    result.mgActive = _mm256_cmp_pd(_mm256_setzero_pd(), negAbsMg, _CMP_GE_OQ);
+    result.egActive = _mm256_cmp_pd(complexityEg, negAbsEg, _CMP_GE_OQ);
+
+    eg = _mm256_fmadd_pd(signOf(eg), _mm256_max_pd(negAbsEg, complexityEg), eg);
+
+    __m256d phase = _mm256_load_pd(block.phase);
+    __m256d egPhase = _mm256_sub_pd(_mm256_set1_pd(1.0), phase);
+    result.eval = _mm256_fmadd_pd(mg, phase, _mm256_mul_pd(eg, egPhase));
+    return result;
+}
+
+AVX2_TARGET inline void addGradient(BasicGradient<double>* gradients, i16 index, __m128d delta)
+{
+    double* grad = &gradients[index].mg;
+    _mm_storeu_pd(grad, _mm_add_pd(_mm_loadu_pd(grad), delta));
+}
+
+// only the low (mg, eg) pair of delta is added
+AVX2_TARGET inline void addGradient(BasicGradient<float>* gradients, i16 index, __m128 delta)
+{
+    BasicGradient<float>* grad = &gradients[index];
+    storeFloatPair(grad, _mm_add_ps(loadFloatPair(grad), delta));
+}
+
+// adds value * (mg, eg) to the gradient of every coefficient in the segment
+AVX2_TARGET inline void scatterSegment(
+    SegmentCursor& cursor, i32 count, __m128d factor, BasicGradient<double>* gradients)
+{
+    const Coefficient* segmentEnd = cursor.coeff + count;
+    const Coefficient* coeff = cursor.coeff;
+    __m256d factors = _mm256_set_m128d(factor, factor);
+    for (; coeff < segmentEnd && coeff + 4 <= cursor.coeffEnd; coeff += 4)
+    {
+        __m256d values01, values23;
+        loadValues(coeff, static_cast<i32>(segmentEnd - coeff), values01, values23);
+        __m256d deltas01 = _mm256_mul_pd(values01, factors);
+        __m256d deltas23 = _mm256_mul_pd(values23, factors);
+        // one at a time, the same index can show up twice in a group
+        addGradient(gradients, coeff[0].index, _mm256_castpd256_pd128(deltas01));
+        addGradient(gradients, coeff[1].index, _mm256_extractf128_pd(deltas01, 1));
+        addGradient(gradients, coeff[2].index, _mm256_castpd256_pd128(deltas23));
+        addGradient(gradients, coeff[3].index, _mm256_extractf128_pd(deltas23, 1));
+    }
+    // only reached at the very end of the coefficient array
+    for (; coeff < segmentEnd; coeff++)
+        addGradient(gradients, coeff->index, _mm_mul_pd(_mm_set1_pd(coeff->value), factor));
+
+    cursor.coeff = segmentEnd;
+}
+
+AVX2_TARGET inline void scatterSegment(
+    SegmentCursor& cursor, i32 count, __m128d factor, BasicGradient<float>* gradients)
+{
+    const Coefficient* segmentEnd = cursor.coeff + count;
+    const Coefficient* coeff = cursor.coeff;
+    __m128 factorPair = _mm_cvtpd_ps(factor);
+    factorPair = _mm_movelh_ps(factorPair, factorPair);
+    __m256 factors = _mm256_set_m128(factorPair, factorPair);
+    for (; coeff < segmentEnd && coeff + 4 <= cursor.coeffEnd; coeff += 4)
+    {
+        __m256 deltas = _mm256_mul_ps(loadValues(coeff, static_cast<i32>(segmentEnd - coeff)), factors);
+        __m128 deltas01 = _mm256_castps256_ps128(deltas);
+        __m128 deltas23 = _mm256_extractf128_ps(deltas, 1);
+        // one at a time, the same index can show up twice in a group
+        addGradient(gradients, coeff[0].index, deltas01);
+        addGradient(gradients, coeff[1].index, _mm_movehl_ps(deltas01, deltas01));
+        addGradient(gradients, coeff[2].index, deltas23);
+        addGradient(gradients, coeff[3].index, _mm_movehl_ps(deltas23, deltas23));
+    }
+    // only reached at the very end of the coefficient array
+    for (; coeff < segmentEnd; coeff++)
+        addGradient(gradients, coeff->index, _mm_mul_ps(_mm_set1_ps(coeff->value), factorPair));
+
+    cursor.coeff = segmentEnd;
+}
+
+template<typename Real>
+AVX2_TARGET void evaluateAvx2(std::span<const Position> positions, Coeffs coefficients,
+    const PackedParam<Real>* params, double* evals)
+{
+    EvalBlock block;
+    alignas(32) double blockEvals[BLOCK_SIZE];
+    for (size_t begin = 0; begin < positions.size(); begin += BLOCK_SIZE)
+    {
+        i32 count = static_cast<i32>(std::min<size_t>(BLOCK_SIZE, positions.size() - begin));
+        accumulateBlock(positions.data() + begin, count, coefficients, params, block);
+        _mm256_store_pd(blockEvals, finishBlock(block).eval);
+        for (i32 lane = 0; lane < count; lane++)
+            evals[begin + lane] = blockEvals[lane];
+    }
+}
+
+template<typename Real>
+AVX2_TARGET double updateGradientsAvx2(std::span<const Position> positions,
+    Coeffs coefficients, const PackedParam<Real>* params, const GradientArgs& args,
+    BasicGradient<Real>* gradients)
+{
+    double error = 0.0;
+    EvalBlock block;
+    alignas(32) double values[BLOCK_SIZE];
+    alignas(32) double targets[BLOCK_SIZE];
+    alignas(32) double egScales[BLOCK_SIZE];
+    alignas(32) double weights[BLOCK_SIZE];
+    alignas(32) double normalMg[BLOCK_SIZE];
+    alignas(32) double normalEg[BLOCK_SIZE];
+    alignas(32) double safetyMg[2][BLOCK_SIZE];
+    alignas(32) double safetyEg[2][BLOCK_SIZE];
+    alignas(32) double complexityEg[BLOCK_SIZE];
+
+    for (size_t begin = 0; begin < positions.size(); begin += BLOCK_SIZE)
+    {
+        const Position* blockPositions = positions.data() + begin;
+        i32 count = static_cast<i32>(std::min<size_t>(BLOCK_SIZE, positions.size() - begin));
+        accumulateBlock(blockPositions, count, coefficients, params, block);
+        EvalBlockResult result = finishBlock(block);
+
+        // exp has no vector equivalent here, so the sigmoids stay scalar
+        _mm256_store_pd(values, result.eval);
+        for (i32 lane = 0; lane < BLOCK_SIZE; lane++)
+        {
+            values[lane] = sigmoid(values[lane], args.kValue);
+            targets[lane] =
+                lane < count ? trainingTarget(blockPositions[lane], args.wdlLambda, args.scoreKValue) : 0;
+            egScales[lane] = lane < count ? blockPositions[lane].egScale() : 0;
+            weights[lane] = lane < count && args.weights ? args.weights[begin + lane] : 1.0;
+        }
+
+        __m256d wdl = _mm256_load_pd(values);
+        __m256d target = _mm256_load_pd(targets);
+        __m256d gradientBase = _mm256_mul_pd(_mm256_sub_pd(wdl, target),
+            _mm256_mul_pd(wdl, _mm256_sub_pd(_mm256_set1_pd(1.0), wdl)));
+        gradientBase = _mm256_mul_pd(gradientBase, _mm256_load_pd(weights));
+        __m256d mgBase = _mm256_mul_pd(gradientBase, _mm256_load_pd(block.phase));
+        __m256d egBase =
+            _mm256_mul_pd(_mm256_sub_pd(gradientBase, mgBase), _mm256_load_pd(egScales));
+
+        __m256d mgFactor = _mm256_and_pd(result.mgActive, mgBase);
+        __m256d egFactor = _mm256_and_pd(result.egActive, egBase);
+        _mm256_store_pd(normalMg, mgFactor);
+        _mm256_store_pd(normalEg, egFactor);
+        for (i32 color = 0; color < 2; color++)
+        {
+            __m256d sign = _mm256_set1_pd(color == 0 ? 1.0 : -1.0);
+            _mm256_store_pd(safetyMg[color],
+                _mm256_mul_pd(_mm256_mul_pd(sign, mgFactor), safetyDeriv(result.safetyMg[color])));
+            _mm256_store_pd(safetyEg[color],
+                _mm256_mul_pd(_mm256_mul_pd(sign, egFactor), safetyDeriv(result.safetyEg[color])));
+        }
+        _mm256_store_pd(complexityEg, _mm256_mul_pd(egFactor, signOf(result.normalEg)));
+
+        for (i32 lane = 0; lane < count; lane++)
+        {
+            double diff = values[lane] - targets[lane];
+            error += weights[lane] * diff * diff;
+
+            const Position& pos = blockPositions[lane];
+            SegmentCursor cursor = {coefficients.data() + pos.coeffBegin,
+                coefficients.data() + coefficients.size()};
+            scatterSegment(
+                cursor, pos.normalCount, _mm_set_pd(normalEg[lane], normalMg[lane]), gradients);
+            for (i32 color = 0; color < 2; color++)
+                scatterSegment(cursor, pos.safetyCount[color],
+                    _mm_set_pd(safetyEg[color][lane], safetyMg[color][lane]), gradients);
+            scatterSegment(cursor, pos.complexityCount, _mm_set_pd(complexityEg[lane], 0.0), gradients);
+        }
+    }
+    return error;
+}
+
+bool cpuSupportsAvx2()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    i32 info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    __cpuid(info, 1);
+    bool fma = info[2] & (1 << 12);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    // the os also has to save the ymm registers
+    if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#endif
+}
+
+}
+
+template<typename Real>
+const TuneKernels<Real>* avx2Kernels()
+{
+    static constexpr TuneKernels<Real> kernels = {
+        "avx2", evaluateAvx2<Real>, updateGradientsAvx2<Real>};
+    static const bool supported = cpuSupportsAvx2();
+    return supported ? &kernels : nullptr;
+}
+
+#else
+
+template<typename Real>
+const TuneKernels<Real>* avx2Kernels()
+{
+    return nullptr;
+}
+
+#endif
+
+template const TuneKernels<float>* avx2Kernels<float>();
+template const TuneKernels<double>* avx2Kernels<double>();